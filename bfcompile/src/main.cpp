@@ -21,20 +21,178 @@
 
 #include <vector>
 #include <memory>
+#include <cstring>
 #include <fstream>
+#include <algorithm>
 #include <filesystem>
 
+#include <dwarf4.h>
+#include <eh_frame.h>
 #include <bfelf_loader.h>
+#include <bfunwindtable.h>
+
+// -----------------------------------------------------------------------------
+// Compact Unwind Table
+// -----------------------------------------------------------------------------
+
+// The .eh_frame section of the loaded image is pre-interpreted here using
+// bfunwind's own DWARF decoder, and the resulting compact unwind table is
+// appended to the image so that the unwinder does not have to decode any
+// DWARF at runtime (see bfunwindtable.h). bfunwind's .eh_frame parser
+// expects this global to exist, but since we provide the .eh_frame section
+// directly, it is not used.
+
+eh_frame_t __g_eh_frame = {};
+
+struct table_entry {
+    uint64_t pc;
+    bool terminator;
+    unwind_table_entry_t entry;
+};
+
+static std::vector<table_entry>
+generate_unwind_table(const struct bfelf_file_t &ef)
+{
+    std::vector<table_entry> table;
+
+    if (ef.eh_frame_addr == 0) {
+        return table;
+    }
+
+    auto eh_frame = eh_frame_t{ef.exec + ef.eh_frame_addr, ef.eh_frame_size, nullptr, 0, nullptr, 0};
+
+    for (auto fde = fd_entry(eh_frame); fde; ++fde) {
+        if (fde.is_cie()) {
+            continue;
+        }
+
+        // An entry covers the PCs that are greater than its PC, which means
+        // every row other than the first has to start one byte early, and
+        // the end of the FDE (which the FDE still covers) is where the
+        // unwinder has to fall back to DWARF, unless another FDE starts
+        // there.
+
+        auto pc_end = fde.pc_begin() + fde.pc_range();
+
+        auto terminator = table_entry{pc_end, true, {}};
+        terminator.entry.cfa_register = UNWIND_TABLE_DWARF;
+        table.push_back(terminator);
+
+        for (auto pc = fde.pc_begin(); pc < pc_end;) {
+            auto entry = table_entry{pc == fde.pc_begin() ? pc : pc - 1, false, {}};
+            pc = dwarf4::compact(fde, pc, &entry.entry);
+            table.push_back(entry);
+        }
+    }
+
+    std::stable_sort(table.begin(), table.end(), [](const auto &lhs, const auto &rhs) {
+        if (lhs.pc != rhs.pc) {
+            return lhs.pc < rhs.pc;
+        }
+
+        return lhs.terminator && !rhs.terminator;
+    });
+
+    // When more than one entry starts at the same PC, only the last one
+    // covers any PCs, and entries that are identical to the entry before
+    // them are not needed at all.
+
+    std::vector<table_entry> compacted;
+    for (auto iter = table.begin(); iter != table.end(); ++iter) {
+        if (auto next = iter + 1; next != table.end() && next->pc == iter->pc) {
+            continue;
+        }
+
+        if (!compacted.empty() &&
+            std::memcmp(&compacted.back().entry, &iter->entry, sizeof(unwind_table_entry_t)) == 0) {
+            continue;
+        }
+
+        compacted.push_back(*iter);
+    }
+
+    return compacted;
+}
+
+// -----------------------------------------------------------------------------
+// Packed Relative Relocations
+// -----------------------------------------------------------------------------
+
+// If the ELF file was not linked with -z pack-relative-relocs, its
+// R_X86_64_RELATIVE relocations are converted into a RELR table, which is
+// appended to the image so that bfelf_file_relocate() can process them
+// using the RELR table instead of .rela.dyn (see bfelf_loader_private.h).
+// If .rela.dyn contains anything that RELR cannot encode, it is left alone.
+
+static std::vector<bfelf_relr>
+generate_relr_table(const struct bfelf_file_t &ef)
+{
+    std::vector<bfelf64_addr> offsets;
+    std::vector<bfelf_relr> table;
+
+    auto rela_table = reinterpret_cast<const struct bfelf_rela *>(ef.exec + ef.rela_array_addr);
+    for (auto i = 0ULL; i < ef.rela_array_size / sizeof(struct bfelf_rela); i++) {
+        const auto &rela = rela_table[i];
+
+        if (BFELF_REL_TYPE(rela.r_info) != BFR_X86_64_RELATIVE) {
+            return {};
+        }
+
+        if ((rela.r_offset % sizeof(bfelf64_addr)) != 0) {
+            return {};
+        }
+
+        offsets.push_back(rela.r_offset);
+    }
+
+    std::sort(offsets.begin(), offsets.end());
+    offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+
+    for (auto iter = offsets.begin(); iter != offsets.end();) {
+        auto where = *iter + sizeof(bfelf64_addr);
+        table.push_back(*iter++);
+
+        while (true) {
+            bfelf_relr bitmap = 0;
+
+            for (; iter != offsets.end(); ++iter) {
+                auto delta = *iter - where;
+                if (delta >= BFELF_RELR_BITS * sizeof(bfelf64_addr)) {
+                    break;
+                }
+
+                bitmap |= 1ULL << (delta / sizeof(bfelf64_addr));
+            }
+
+            if (bitmap == 0) {
+                break;
+            }
+
+            table.push_back((bitmap << 1) | 1);
+            where += BFELF_RELR_BITS * sizeof(bfelf64_addr);
+        }
+    }
+
+    return table;
+}
 
 // -----------------------------------------------------------------------------
 // Implementation
 // -----------------------------------------------------------------------------
 
+// Usage: bfcompile <ELF file> <image> <ef> [base]
+//
+// If a base address is provided, the image is relocated for that address,
+// and the ef is marked as relocated, so that an image that is always loaded
+// at the same address (e.g., a fixed physical window, or MAP_FIXED) does not
+// have to be relocated when it is started. If it is loaded somewhere else,
+// bfelf_file_relocate() will still move it.
+
 int main(int argc, char *argv[])
 {
     std::vector<char> file;
 
-    if (argc != 4) {
+    if (argc != 4 && argc != 5) {
         throw std::runtime_error("wrong number of arguments");
     }
 
@@ -57,8 +215,69 @@ int main(int argc, char *argv[])
         throw std::runtime_error("failed to load the ELF file");
     }
 
+    auto table = generate_unwind_table(ef);
+    auto table_addr = BFALIGN(ef.size, sizeof(uint64_t));
+
+    // Each entry stores its PC as a signed 32bit offset from the start of the
+    // table, so if any PC is out of range, the table is not appended at all,
+    // and the unwinder falls back to decoding the .eh_frame section.
+
+    for (const auto &elem : table) {
+        auto pc = static_cast<int64_t>(elem.pc - reinterpret_cast<uint64_t>(exec.get()));
+        auto offset = pc - static_cast<int64_t>(table_addr);
+
+        if (offset < INT32_MIN || offset > INT32_MAX) {
+            table.clear();
+            break;
+        }
+    }
+    auto table_size = table.size() * sizeof(unwind_table_entry_t);
+    auto table_end = table.empty() ? ef.size : table_addr + table_size;
+
+    auto relr = ef.relr_array_size != 0 ? std::vector<bfelf_relr>{} : generate_relr_table(ef);
+    auto relr_addr = BFALIGN(table_end, sizeof(bfelf_relr));
+    auto relr_size = relr.size() * sizeof(bfelf_relr);
+
+    auto image = std::vector<char>(relr.empty() ? table_end : relr_addr + relr_size);
+    std::memcpy(image.data(), exec.get(), ef.size);
+
+    if (!relr.empty()) {
+        std::memcpy(&image.at(relr_addr), relr.data(), relr_size);
+
+        ef.relr_array_addr = relr_addr;
+        ef.relr_array_size = relr_size;
+        ef.rela_array_size = 0;
+    }
+
+    for (auto i = 0ULL; i < table.size(); i++) {
+        auto entry = table.at(i).entry;
+        auto pc = table.at(i).pc - reinterpret_cast<uint64_t>(exec.get());
+
+        entry.pc = static_cast<int32_t>(static_cast<int64_t>(pc) - static_cast<int64_t>(table_addr));
+        std::memcpy(&image.at(table_addr + (i * sizeof(entry))), &entry, sizeof(entry));
+    }
+
+    if (!table.empty()) {
+        ef.unwind_table_addr = table_addr;
+        ef.unwind_table_size = table_size;
+    }
+
+    ef.size = image.size();
+
+    if (argc == 5) {
+        auto base = std::stoull(argv[4], nullptr, 0);
+        if (base == 0 || (base % BFELF_PAGE_SIZE) != 0) {
+            throw std::runtime_error("base address must be a non-zero, page aligned address");
+        }
+
+        ef.exec = reinterpret_cast<uint8_t *>(image.data());
+        if (bfelf_file_relocate(&ef, base) != BFSUCCESS) {
+            throw std::runtime_error("failed to relocate the ELF file");
+        }
+    }
+
     if (auto strm = std::ofstream(argv[2], std::fstream::binary)) {
-        strm.write(exec.get(), ef.size);
+        strm.write(image.data(), static_cast<std::streamsize>(image.size()));
     }
     else {
         throw std::runtime_error("failed to open output file");
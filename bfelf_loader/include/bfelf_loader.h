@@ -77,6 +77,12 @@
  *   - We only support a single RELA section. REL sections are not supported.
  *     Furthermore, the only relocation type that we support is R_xxx_RELATIVE.
  *   - We do not support the legacy init, fini, ctors and dtors sections.
+ *   - The RELA, RELR and init/fini array tables are found using the
+ *     PT_DYNAMIC segment, and .eh_frame is found using PT_GNU_EH_FRAME, so
+ *     the section headers are only needed by ELF files that do not have
+ *     these segments (i.e., PIE ELF files linked with --eh-frame-hdr can be
+ *     fully stripped). Note that the ctors and dtors sections can only be
+ *     detected if the section headers are present.
  *   - We only support read/write stacks. Execution rights on the stack are
  *     not supported.
  *   - In general, the ELF loader is picky about the types of sections, and
@@ -121,6 +127,60 @@ extern "C" {
  *      the address of the eh_frame section
  * @var bfelf_file_t::eh_frame_size
  *      the size of the eh_frame section
+ * @var bfelf_file_t::eh_frame_hdr_addr
+ *      the address of the eh_frame_hdr section (PT_GNU_EH_FRAME), or 0 if
+ *      the ELF file was not linked with --eh-frame-hdr
+ * @var bfelf_file_t::eh_frame_hdr_size
+ *      the size of the eh_frame_hdr section
+ * @var bfelf_file_t::unwind_table_addr
+ *      the address of the compact unwind table (see bfunwindtable.h), or 0
+ *      if the ELF file was not compiled using bfcompile
+ * @var bfelf_file_t::unwind_table_size
+ *      the size of the compact unwind table
+ * @var bfelf_file_t::rw_offset
+ *      the offset in "exec" of the first RW segment (this is an offset and
+ *      not an address, so it is not changed by bfelf_file_relocate)
+ * @var bfelf_file_t::rw_filesz
+ *      the number of bytes starting at rw_offset that contain the file
+ *      portion of the RW segments (i.e., .data and friends)
+ * @var bfelf_file_t::rw_memsz
+ *      the number of bytes starting at rw_offset that are covered by the RW
+ *      segments, including the BSS (i.e., all of the application's global
+ *      state lives in this range)
+ * @var bfelf_file_t::exec_zeroed
+ *      set this to 1 (after calling bfelf_file_init) if the memory passed to
+ *      bfelf_file_load is already zeroed (e.g., it was allocated using mmap
+ *      or UEFI's AllocatePages), in which case bfelf_file_load only copies
+ *      the file portion of each segment and does not zero anything
+ * @var bfelf_file_t::exec_lazy
+ *      set this to 1 (after calling bfelf_file_init) if the caller fills in
+ *      the pages of "exec" on demand (e.g., using userfaultfd on Linux), in
+ *      which case bfelf_file_load and bfelf_file_relocate never touch
+ *      "exec". They only record the layout of the image and relocate the
+ *      addresses in this structure, and the caller must copy each page from
+ *      the ELF file and apply the relocations in .rela.dyn and .relr.dyn
+ *      that fall in it (rela_array_addr/size and relr_array_addr/size give
+ *      the location of these tables in "exec") when the page is first
+ *      touched
+ * @var bfelf_file_t::map_file
+ *      optionally set this (after calling bfelf_file_init) to a function that
+ *      maps "size" bytes of the ELF file starting at "offset" to "addr" (e.g.,
+ *      using mmap with MAP_PRIVATE | MAP_FIXED). Both "addr" and "offset" are
+ *      aligned to BFELF_PAGE_SIZE. If provided, bfelf_file_load maps RX
+ *      segments that are page aligned in the ELF file (i.e., the ELF file was
+ *      linked with -z max-page-size=0x1000) instead of copying them, so the
+ *      text of the ELF file is executed directly from the file's pages. Only
+ *      RW segments and the BSS are copied/zeroed. The pages around an RX
+ *      segment are mapped too, so "exec" must be page aligned memory that the
+ *      mapping can replace (e.g., from mmap, not malloc).
+ * @var bfelf_file_t::parallel_for
+ *      optionally set this (after calling bfelf_file_init) to a function that
+ *      calls func(ctx, i) for every i in [0, num), possibly from more than one
+ *      thread at the same time, and only returns once all of the calls have
+ *      returned. If provided, bfelf_file_load and bfelf_file_relocate split
+ *      large copies (BFELF_PARALLEL_COPY_SIZE) and large relocation tables
+ *      (BFELF_PARALLEL_RELOCS) into chunks that do not overlap, and hand
+ *      them to this function (e.g., a thread pool on the host).
  */
 
 /**
@@ -176,11 +236,50 @@ extern "C" {
 static inline status_t
 bfelf_file_init(const void *file, struct bfelf_file_t *ef);
 
+/**
+ * Initialize an ELF file (Streaming)
+ *
+ * This function is the same as bfelf_file_init(), except that instead of a
+ * buffer containing the entire ELF file, it takes a read function that is
+ * used to read the ELF file on demand. This allows the ELF file to be loaded
+ * without first reading the whole file into memory: bfelf_file_load() reads
+ * the headers it needs one at a time, and reads each PT_LOAD segment
+ * directly into "exec", so the only copy of the ELF file's contents is the
+ * one in "exec".
+ *
+ * The read function must read "size" bytes starting at "offset" in the ELF
+ * file into "buf", and return BFSUCCESS, or BFFAILURE if it cannot (e.g., the
+ * read is past the end of the file). The read function is only called from
+ * bfelf_file_init_stream() and bfelf_file_load(), after which it is no
+ * longer needed.
+ *
+ * @code
+ * struct bfelf_file_t ef;
+ * bfelf_file_init_stream(read_func, &ef);
+ * void *exec = malloc(ef.size);
+ * bfelf_file_load(&ef, exec, nullptr);
+ * bfelf_file_relocate(&ef, 0);
+ * free(exec);
+ * @endcode
+ *
+ * @expects read_func != nullptr
+ * @expects ef != nullptr
+ * @ensures
+ *
+ * @param read_func the function used to read the ELF file
+ * @param ef a pointer to the bfelf_file_t structure which stores information
+ *     about the ELF file being loaded.
+ * @return BFSUCCESS on success, BFFAILURE on error
+ */
+static inline status_t
+bfelf_file_init_stream(
+    status_t (*read_func)(bfelf64_off, void *, bfelf64_xword), struct bfelf_file_t *ef);
+
 /**
  * Load an ELF file
  *
  * This function loads the ELF file that was previously initialized using the
- * bfelf_file_init function. The main purpose of the bfelf_file_init function
+ * bfelf_file_init (or bfelf_file_init_stream) function. The main purpose of the bfelf_file_init function
  * is to make sure the ELF file is valid, to store some private internal state
  * and then populate the "size" field so that the user of these APIs knows
  * how much memory to allocate. The ELF file itself cannot be directly
@@ -193,7 +292,10 @@ bfelf_file_init(const void *file, struct bfelf_file_t *ef);
  * Besides providing the bfelf_file_t that was initialied using the
  * bfelf_file_init() function, this function takes some additional parameters.
  * The first, "exec" is the address to the memory that must be allocated
- * by the user. Finally, this function allows you to pass a mark_rx function
+ * by the user. This memory does not need to be zeroed. Only the portions of
+ * the image that are not copied from the ELF file are zeroed, and if the
+ * memory was already zeroed by the allocator, ef.exec_zeroed can be set so
+ * that this step is skipped as well. Finally, this function allows you to pass a mark_rx function
  * which will be called to mark a portion of the "exec" memory as read/execute.
  * If your memory was allocated as RWE, this function is not needed and you can
  * safely pass a nullptr instead. If your memory was allocated as RW, which is
@@ -229,6 +331,18 @@ bfelf_file_load(struct bfelf_file_t *ef, void *exec, status_t (*mark_rx_func)(vo
  *   structure prior to running this API, which will force the exec to be equal
  *   to the virtual address you provide.
  *
+ * Both .rela.dyn (which may only contain R_X86_64_RELATIVE relocations) and
+ * .relr.dyn (i.e., DT_RELR, produced by linking with -z pack-relative-relocs
+ * or by bfcompile) are supported. RELR tables are much smaller and much
+ * faster to process, so static PIEs with a lot of relocations (e.g., a lot
+ * of vtables) should be linked with -z pack-relative-relocs.
+ *
+ * If the ELF file was already relocated (either by a previous call to this
+ * function, or by bfcompile, which can relocate an ELF file for a fixed base
+ * address), this function does nothing if "virt" is the address the ELF file
+ * was relocated for. Otherwise, the ELF file is moved to "virt" by relocating
+ * it by the difference between the two addresses.
+ *
  * @expects ef != nullptr
  * @ensures
  *
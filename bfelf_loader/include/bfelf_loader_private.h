@@ -25,6 +25,88 @@
 
 #include <bftypes.h>
 
+/*
+ * Memory Operations
+ *
+ * bfelf_file_load() copies every PT_LOAD segment into the image and zeros
+ * the rest of it, so for large images, the implementation of memcpy and
+ * memset determines how long it takes to load the ELF file. Since this code
+ * cannot depend on a libc, the implementation is chosen at compile time by
+ * defining BFELF_LOADER_MEMOPS to one of the following:
+ *
+ * - BFELF_LOADER_MEMOPS_BYTE: one byte at a time (works everywhere)
+ * - BFELF_LOADER_MEMOPS_WORD: 8 bytes at a time (the default on non-x86)
+ * - BFELF_LOADER_MEMOPS_REP: rep movsb / rep stosb (the default on x86_64)
+ * - BFELF_LOADER_MEMOPS_SSE2: 16 bytes at a time using SSE2. This is never
+ *   the default as most kernels do not allow SSE without saving the FPU
+ *   state first.
+ *
+ * Both functions can also be replaced completely by defining
+ * BFELF_LOADER_MEMCPY and BFELF_LOADER_MEMSET.
+ */
+
+#define BFELF_LOADER_MEMOPS_BYTE 1
+#define BFELF_LOADER_MEMOPS_WORD 2
+#define BFELF_LOADER_MEMOPS_REP 3
+#define BFELF_LOADER_MEMOPS_SSE2 4
+
+#if (defined(__x86_64__) && defined(__GNUC__)) || (defined(_M_X64) && defined(_MSC_VER))
+#define BFELF_LOADER_HAS_REP
+#endif
+
+#if defined(__SSE2__)
+#define BFELF_LOADER_HAS_SSE2
+#endif
+
+#ifndef BFELF_LOADER_MEMOPS
+#ifdef BFELF_LOADER_HAS_REP
+#define BFELF_LOADER_MEMOPS BFELF_LOADER_MEMOPS_REP
+#else
+#define BFELF_LOADER_MEMOPS BFELF_LOADER_MEMOPS_WORD
+#endif
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef BFELF_LOADER_HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+ * Page Size
+ *
+ * The page size used to decide if a segment can be mapped directly from the
+ * ELF file (see bfelf_file_t::map_file). This must match the page size of
+ * the platform that provides map_file, and the ELF file must be linked with
+ * a max-page-size that is a multiple of it.
+ */
+
+#ifndef BFELF_PAGE_SIZE
+#define BFELF_PAGE_SIZE 0x1000
+#endif
+
+/*
+ * Parallel Loading
+ *
+ * If a parallel_for function is provided (see bfelf_file_t::parallel_for),
+ * copies and memsets larger than BFELF_PARALLEL_COPY_SIZE are split into
+ * chunks of that size, and relocation tables are split into chunks of
+ * BFELF_PARALLEL_RELOCS relocations, each of which is handed to
+ * parallel_for. Each chunk writes to memory that no other chunk touches
+ * (every relocation is relative and relocates a different word), so the
+ * chunks can run in any order, on any number of threads.
+ */
+
+#ifndef BFELF_PARALLEL_COPY_SIZE
+#define BFELF_PARALLEL_COPY_SIZE 0x100000
+#endif
+
+#ifndef BFELF_PARALLEL_RELOCS
+#define BFELF_PARALLEL_RELOCS 0x10000
+#endif
+
 #pragma pack(push, 1)
 
 #ifdef __cplusplus
@@ -101,7 +183,7 @@ struct bfelf_ehdr;
 struct bfelf_file_t {
 
     const uint8_t *file;
-    const struct bfelf_ehdr *ehdr;
+    status_t (*read)(bfelf64_off offset, void *buf, bfelf64_xword size);
 
     uint8_t *exec;
     size_t size;
@@ -111,6 +193,9 @@ struct bfelf_file_t {
     bfelf64_addr rela_array_addr;
     bfelf64_xword rela_array_size;
 
+    bfelf64_addr relr_array_addr;
+    bfelf64_xword relr_array_size;
+
     bfelf64_addr init_array_addr;
     bfelf64_xword init_array_size;
 
@@ -120,6 +205,22 @@ struct bfelf_file_t {
     bfelf64_addr eh_frame_addr;
     bfelf64_xword eh_frame_size;
 
+    bfelf64_addr eh_frame_hdr_addr;
+    bfelf64_xword eh_frame_hdr_size;
+
+    bfelf64_addr unwind_table_addr;
+    bfelf64_xword unwind_table_size;
+
+    bfelf64_addr rw_offset;
+    bfelf64_xword rw_filesz;
+    bfelf64_xword rw_memsz;
+
+    status_t (*map_file)(void *addr, bfelf64_off offset, bfelf64_xword size);
+    void (*parallel_for)(void (*func)(void *, bfelf64_xword), void *ctx, bfelf64_xword num);
+
+    bfelf64_addr base;
+    uint8_t exec_zeroed;
+    uint8_t exec_lazy;
     uint8_t relocated;
 };
 
@@ -415,6 +516,46 @@ struct bfelf_phdr {
     bfelf64_xword p_align;
 };
 
+/* -------------------------------------------------------------------------- */
+/* ELF Dynamic Section                                                        */
+/* -------------------------------------------------------------------------- */
+
+/*
+ * ELF Dynamic Section Tags
+ *
+ * The following is defined in the ELF 64bit file format specification:
+ * http://www.uclibc.org/docs/elf-64-gen.pdf, page 14 (DT_RELR and
+ * DT_RELRSZ are defined in the System V gABI)
+ */
+
+#define bfdt_null BFSCAST(bfelf64_sxword, 0)
+#define bfdt_rela BFSCAST(bfelf64_sxword, 7)
+#define bfdt_relasz BFSCAST(bfelf64_sxword, 8)
+#define bfdt_init BFSCAST(bfelf64_sxword, 12)
+#define bfdt_fini BFSCAST(bfelf64_sxword, 13)
+#define bfdt_init_array BFSCAST(bfelf64_sxword, 25)
+#define bfdt_fini_array BFSCAST(bfelf64_sxword, 26)
+#define bfdt_init_arraysz BFSCAST(bfelf64_sxword, 27)
+#define bfdt_fini_arraysz BFSCAST(bfelf64_sxword, 28)
+#define bfdt_relrsz BFSCAST(bfelf64_sxword, 35)
+#define bfdt_relr BFSCAST(bfelf64_sxword, 36)
+
+/*
+ * ELF Dynamic Section Entry
+ *
+ * The following is defined in the ELF 64bit file format specification:
+ * http://www.uclibc.org/docs/elf-64-gen.pdf, page 14
+ *
+ * The PT_DYNAMIC segment is an array of these entries, terminated by a
+ * DT_NULL entry. Unlike the section headers, the PT_DYNAMIC segment is
+ * needed at runtime, so it cannot be stripped from the ELF file.
+ */
+
+struct bfelf_dyn {
+    bfelf64_sxword d_tag;
+    bfelf64_xword d_val;
+};
+
 /* -------------------------------------------------------------------------- */
 /* ELF Relocations                                                            */
 /* -------------------------------------------------------------------------- */
@@ -442,6 +583,29 @@ struct bfelf_rela {
 #define BFELF_REL_SYM(i) ((i) >> 32)
 #define BFELF_REL_TYPE(i) ((i)&0xFFFFFFFFL)
 
+/*
+ * ELF Relative Relocations (RELR)
+ *
+ * The following is defined in the System V gABI (DT_RELR), and is produced
+ * by ld using -z pack-relative-relocs (or by bfcompile):
+ * https://groups.google.com/g/generic-abi/c/bX460iggiKg
+ *
+ * A RELR table is an array of words that only encodes the offsets of
+ * R_X86_64_RELATIVE relocations (the addend is stored in place). An even
+ * word is the offset of a relocation, and the next word is the following
+ * offset. An odd word is a bitmap: bit n (n = 1 to 63) means the word at
+ * offset + ((n - 1) * 8) has a relocation, after which offset moves forward
+ * by 63 words.
+ */
+
+#ifndef __cplusplus
+typedef bfelf64_xword bfelf_relr;
+#else
+using bfelf_relr = bfelf64_xword;
+#endif
+
+#define BFELF_RELR_BITS 63
+
 /*
  * System V ABI 64bit Relocations
  *
@@ -474,9 +638,22 @@ private_strcmp(const char *s1, const char *s2)
 #define private_strcmp BFELF_LOADER_STRCMP
 #endif
 
-#ifndef BFELF_LOADER_MEMCPY
+#ifndef __cplusplus
+#ifdef __GNUC__
+typedef uint64_t __attribute__((may_alias, aligned(1))) private_word_t;
+#else
+typedef uint64_t private_word_t;
+#endif
+#else
+#ifdef __GNUC__
+using private_word_t = uint64_t __attribute__((may_alias, aligned(1)));
+#else
+using private_word_t = uint64_t;
+#endif
+#endif
+
 static inline void
-private_memcpy(void *dst, const void *src, bfelf64_xword size)
+private_memcpy_byte(void *dst, const void *src, bfelf64_xword size)
 {
     bfelf64_xword i;
 
@@ -484,13 +661,9 @@ private_memcpy(void *dst, const void *src, bfelf64_xword size)
         BFSCAST(uint8_t *, dst)[i] = BFSCAST(const uint8_t *, src)[i];
     }
 }
-#else
-#define private_memcpy BFELF_LOADER_MEMCPY
-#endif
 
-#ifndef BFELF_LOADER_MEMSET
 static inline void
-private_memset(void *dst, uint8_t val, bfelf64_xword size)
+private_memset_byte(void *dst, uint8_t val, bfelf64_xword size)
 {
     bfelf64_xword i;
 
@@ -498,6 +671,137 @@ private_memset(void *dst, uint8_t val, bfelf64_xword size)
         BFRCAST(uint8_t *, dst)[i] = val;
     }
 }
+
+static inline void
+private_memcpy_word(void *dst, const void *src, bfelf64_xword size)
+{
+    uint8_t *d = BFSCAST(uint8_t *, dst);
+    const uint8_t *s = BFSCAST(const uint8_t *, src);
+
+    while (size != 0 && (BFRCAST(uintptr_t, d) & (sizeof(private_word_t) - 1)) != 0) {
+        *d++ = *s++;
+        size--;
+    }
+
+    while (size >= sizeof(private_word_t)) {
+        *BFRCAST(private_word_t *, d) = *BFRCAST(const private_word_t *, s);
+        d += sizeof(private_word_t);
+        s += sizeof(private_word_t);
+        size -= sizeof(private_word_t);
+    }
+
+    private_memcpy_byte(d, s, size);
+}
+
+static inline void
+private_memset_word(void *dst, uint8_t val, bfelf64_xword size)
+{
+    uint8_t *d = BFSCAST(uint8_t *, dst);
+    uint64_t word = BFSCAST(uint64_t, val) * 0x0101010101010101ULL;
+
+    while (size != 0 && (BFRCAST(uintptr_t, d) & (sizeof(private_word_t) - 1)) != 0) {
+        *d++ = val;
+        size--;
+    }
+
+    while (size >= sizeof(private_word_t)) {
+        *BFRCAST(private_word_t *, d) = word;
+        d += sizeof(private_word_t);
+        size -= sizeof(private_word_t);
+    }
+
+    private_memset_byte(d, val, size);
+}
+
+#ifdef BFELF_LOADER_HAS_REP
+static inline void
+private_memcpy_rep(void *dst, const void *src, bfelf64_xword size)
+{
+#ifdef _MSC_VER
+    __movsb(BFSCAST(unsigned char *, dst), BFSCAST(const unsigned char *, src), size);
+#else
+    __asm__ __volatile__("rep movsb" : "+D"(dst), "+S"(src), "+c"(size) : : "memory");
+#endif
+}
+
+static inline void
+private_memset_rep(void *dst, uint8_t val, bfelf64_xword size)
+{
+#ifdef _MSC_VER
+    __stosb(BFSCAST(unsigned char *, dst), val, size);
+#else
+    __asm__ __volatile__("rep stosb" : "+D"(dst), "+c"(size) : "a"(val) : "memory");
+#endif
+}
+#endif
+
+#ifdef BFELF_LOADER_HAS_SSE2
+static inline void
+private_memcpy_sse2(void *dst, const void *src, bfelf64_xword size)
+{
+    uint8_t *d = BFSCAST(uint8_t *, dst);
+    const uint8_t *s = BFSCAST(const uint8_t *, src);
+
+    while (size != 0 && (BFRCAST(uintptr_t, d) & (sizeof(__m128i) - 1)) != 0) {
+        *d++ = *s++;
+        size--;
+    }
+
+    while (size >= sizeof(__m128i)) {
+        _mm_store_si128(BFRCAST(__m128i *, d), _mm_loadu_si128(BFRCAST(const __m128i *, s)));
+        d += sizeof(__m128i);
+        s += sizeof(__m128i);
+        size -= sizeof(__m128i);
+    }
+
+    private_memcpy_byte(d, s, size);
+}
+
+static inline void
+private_memset_sse2(void *dst, uint8_t val, bfelf64_xword size)
+{
+    uint8_t *d = BFSCAST(uint8_t *, dst);
+    __m128i data = _mm_set1_epi8(BFSCAST(char, val));
+
+    while (size != 0 && (BFRCAST(uintptr_t, d) & (sizeof(__m128i) - 1)) != 0) {
+        *d++ = val;
+        size--;
+    }
+
+    while (size >= sizeof(__m128i)) {
+        _mm_store_si128(BFRCAST(__m128i *, d), data);
+        d += sizeof(__m128i);
+        size -= sizeof(__m128i);
+    }
+
+    private_memset_byte(d, val, size);
+}
+#endif
+
+#ifndef BFELF_LOADER_MEMCPY
+#if BFELF_LOADER_MEMOPS == BFELF_LOADER_MEMOPS_SSE2
+#define private_memcpy private_memcpy_sse2
+#elif BFELF_LOADER_MEMOPS == BFELF_LOADER_MEMOPS_REP
+#define private_memcpy private_memcpy_rep
+#elif BFELF_LOADER_MEMOPS == BFELF_LOADER_MEMOPS_WORD
+#define private_memcpy private_memcpy_word
+#else
+#define private_memcpy private_memcpy_byte
+#endif
+#else
+#define private_memcpy BFELF_LOADER_MEMCPY
+#endif
+
+#ifndef BFELF_LOADER_MEMSET
+#if BFELF_LOADER_MEMOPS == BFELF_LOADER_MEMOPS_SSE2
+#define private_memset private_memset_sse2
+#elif BFELF_LOADER_MEMOPS == BFELF_LOADER_MEMOPS_REP
+#define private_memset private_memset_rep
+#elif BFELF_LOADER_MEMOPS == BFELF_LOADER_MEMOPS_WORD
+#define private_memset private_memset_word
+#else
+#define private_memset private_memset_byte
+#endif
 #else
 #define private_memset BFELF_LOADER_MEMSET
 #endif
@@ -506,34 +810,180 @@ private_memset(void *dst, uint8_t val, bfelf64_xword size)
 /* ELF Helpers (Internal)                                                     */
 /* -------------------------------------------------------------------------- */
 
-const struct bfelf_shdr *
-private_shdrtab(
-    struct bfelf_file_t *ef)
-{ return BFRCAST(const struct bfelf_shdr *, ef->file + ef->ehdr->e_shoff); }
+struct private_parallel_copy_t {
+    uint8_t *dst;
+    const uint8_t *src;
+    bfelf64_xword size;
+};
 
-const struct bfelf_phdr *
-private_phdrtab(
-    struct bfelf_file_t *ef)
-{ return BFRCAST(const struct bfelf_phdr *, ef->file + ef->ehdr->e_phoff); }
+static inline void
+private_parallel_copy_chunk(void *ctx, bfelf64_xword i)
+{
+    struct private_parallel_copy_t *args = BFSCAST(struct private_parallel_copy_t *, ctx);
 
-const char *
-private_shstrtab(
-    struct bfelf_file_t *ef)
-{ return BFRCAST(const char *, ef->file + private_shdrtab(ef)[ef->ehdr->e_shstrndx].sh_offset); }
+    bfelf64_xword offset = i * BFELF_PARALLEL_COPY_SIZE;
+    bfelf64_xword size = args->size - offset;
+
+    if (size > BFELF_PARALLEL_COPY_SIZE) {
+        size = BFELF_PARALLEL_COPY_SIZE;
+    }
+
+    if (args->src != nullptr) {
+        private_memcpy(args->dst + offset, args->src + offset, size);
+    }
+    else {
+        private_memset(args->dst + offset, 0, size);
+    }
+}
+
+/*
+ * Copies "size" bytes from "src" to "dst", or zeros them if "src" is a
+ * nullptr, using ef->parallel_for if the copy is large enough to split.
+ */
+static inline void
+private_load_copy(
+    const struct bfelf_file_t *ef, void *dst, const void *src, bfelf64_xword size)
+{
+    struct private_parallel_copy_t args;
+
+    if (ef->parallel_for == nullptr || size <= BFELF_PARALLEL_COPY_SIZE) {
+        if (src != nullptr) {
+            private_memcpy(dst, src, size);
+        }
+        else {
+            private_memset(dst, 0, size);
+        }
+
+        return;
+    }
+
+    args.dst = BFSCAST(uint8_t *, dst);
+    args.src = BFSCAST(const uint8_t *, src);
+    args.size = size;
+
+    ef->parallel_for(
+        private_parallel_copy_chunk, &args, (size + BFELF_PARALLEL_COPY_SIZE - 1) / BFELF_PARALLEL_COPY_SIZE);
+}
+
+/*
+ * The ELF file is either provided as a buffer (bfelf_file_init), or as a
+ * read function (bfelf_file_init_stream). All access to the ELF file goes
+ * through private_read so that the rest of the loader does not care which.
+ * Headers are read into local variables one at a time, and PT_LOAD segments
+ * are read directly into exec.
+ */
+
+static inline status_t
+private_read(
+    const struct bfelf_file_t *ef, bfelf64_off offset, void *buf, bfelf64_xword size)
+{
+    if (ef->read != nullptr) {
+        if (ef->read(offset, buf, size) != BFSUCCESS) {
+            BFALERT("failed to read from the ELF file\n");
+            return BFFAILURE;
+        }
+
+        return BFSUCCESS;
+    }
+
+    private_load_copy(ef, buf, ef->file + offset, size);
+    return BFSUCCESS;
+}
+
+static inline status_t
+private_read_ehdr(
+    const struct bfelf_file_t *ef, struct bfelf_ehdr *ehdr)
+{ return private_read(ef, 0, ehdr, sizeof(struct bfelf_ehdr)); }
+
+static inline status_t
+private_read_phdr(
+    const struct bfelf_file_t *ef, const struct bfelf_ehdr *ehdr, bfelf64_half i, struct bfelf_phdr *phdr)
+{ return private_read(ef, ehdr->e_phoff + (i * sizeof(struct bfelf_phdr)), phdr, sizeof(struct bfelf_phdr)); }
+
+static inline status_t
+private_read_shdr(
+    const struct bfelf_file_t *ef, const struct bfelf_ehdr *ehdr, bfelf64_half i, struct bfelf_shdr *shdr)
+{ return private_read(ef, ehdr->e_shoff + (i * sizeof(struct bfelf_shdr)), shdr, sizeof(struct bfelf_shdr)); }
+
+/*
+ * Only the first size - 1 characters of a section's name are read, which
+ * is enough to compare the name against the sections the loader cares about.
+ */
+static inline status_t
+private_read_name(
+    const struct bfelf_file_t *ef, const struct bfelf_shdr *shstrtab, bfelf64_word name, char *buf, bfelf64_xword size)
+{
+    bfelf64_xword len = size - 1;
+
+    if (name >= shstrtab->sh_size) {
+        BFALERT("section name is outside of the string table\n");
+        return BFFAILURE;
+    }
+
+    if (len > shstrtab->sh_size - name) {
+        len = shstrtab->sh_size - name;
+    }
+
+    private_memset(buf, 0, size);
+    return private_read(ef, shstrtab->sh_offset + name, buf, len);
+}
+
+/*
+ * A PT_LOAD segment can be mapped from the ELF file instead of being copied
+ * if it is read/execute (i.e., the segment will never be written to), it
+ * has no BSS, and its file offset and address in exec are congruent modulo
+ * the page size. The pages that are mapped must also not overlap anything
+ * that has already been written to exec (cursor), or run past the end of
+ * exec. Returns the size of the mapping, or 0 if the segment must be copied.
+ */
+static inline bfelf64_xword
+private_map_size(
+    const struct bfelf_file_t *ef, const struct bfelf_phdr *phdr, bfelf64_addr offset, bfelf64_addr cursor)
+{
+    bfelf64_addr mask = BFELF_PAGE_SIZE - 1;
+    bfelf64_addr lead = phdr->p_offset & mask;
+
+    if (ef->map_file == nullptr) {
+        return 0;
+    }
+
+    if (phdr->p_flags != bfpf_rx || phdr->p_filesz != phdr->p_memsz) {
+        return 0;
+    }
+
+    if (((BFRCAST(bfelf64_addr, ef->exec) + offset) & mask) != lead) {
+        return 0;
+    }
+
+    if (offset < cursor || offset - cursor < lead) {
+        return 0;
+    }
+
+    if (offset - lead + BFALIGN(lead + phdr->p_filesz, BFELF_PAGE_SIZE) > ef->size) {
+        return 0;
+    }
+
+    return BFALIGN(lead + phdr->p_filesz, BFELF_PAGE_SIZE);
+}
 
-const struct bfelf_rela *
+static inline const struct bfelf_rela *
 private_relatab(
     struct bfelf_file_t *ef)
 { return BFRCAST(const struct bfelf_rela *, ef->exec + ef->rela_array_addr); }
 
+static inline const bfelf_relr *
+private_relrtab(
+    struct bfelf_file_t *ef)
+{ return BFRCAST(const bfelf_relr *, ef->exec + ef->relr_array_addr); }
+
 /* -------------------------------------------------------------------------- */
 /* ELF Implementation (File Valid)                                            */
 /* -------------------------------------------------------------------------- */
 
 /*
  * Notes:
- * - Once the init function is run, the file and ehdr variables in the ef
- *   struct are valid. Once the load function is complete, these variables
+ * - Once the init function is run, the file (or read) variable in the ef
+ *   struct is valid. Once the load function is complete, these variables
  *   are zero'd out and they are no longer valid. If you make mods, make sure
  *   you pay attention to this. The relocate function must be able to execute
  *   without direct access to the ELF file.
@@ -548,191 +998,370 @@ private_relatab(
  */
 
 static inline status_t
-bfelf_file_init(const void *file, struct bfelf_file_t *ef)
+private_file_init(struct bfelf_file_t *ef)
 {
     bfelf64_half i;
-    const struct bfelf_phdr *first = nullptr;
-
-    if (file == nullptr) {
-        BFALERT("file == nullptr\n");
-        return BFFAILURE;
-    }
+    struct bfelf_ehdr ehdr;
+    struct bfelf_phdr phdr;
+    bfelf64_addr first = 0;
+    uint8_t found = 0;
 
-    if (ef == nullptr) {
-        BFALERT("ef == nullptr\n");
+    if (private_read_ehdr(ef, &ehdr) != BFSUCCESS) {
         return BFFAILURE;
     }
 
-    private_memset(ef, 0, sizeof(struct bfelf_file_t));
-
-    ef->file = BFSCAST(const uint8_t *, file);
-    ef->ehdr = BFRCAST(const struct bfelf_ehdr *, file);
-
-    if (ef->ehdr->e_ident[bfei_mag0] != 0x7F) {
+    if (ehdr.e_ident[bfei_mag0] != 0x7F) {
         BFALERT("magic #0 has unexpected value\n");
         return BFFAILURE;
     }
 
-    if (ef->ehdr->e_ident[bfei_mag1] != 'E') {
+    if (ehdr.e_ident[bfei_mag1] != 'E') {
         BFALERT("magic #1 has unexpected value\n");
         return BFFAILURE;
     }
 
-    if (ef->ehdr->e_ident[bfei_mag2] != 'L') {
+    if (ehdr.e_ident[bfei_mag2] != 'L') {
         BFALERT("magic #2 has unexpected value\n");
         return BFFAILURE;
     }
 
-    if (ef->ehdr->e_ident[bfei_mag3] != 'F') {
+    if (ehdr.e_ident[bfei_mag3] != 'F') {
         BFALERT("magic #3 has unexpected value\n");
         return BFFAILURE;
     }
 
-    if (ef->ehdr->e_ident[bfei_class] != bfelfclass64) {
+    if (ehdr.e_ident[bfei_class] != bfelfclass64) {
         BFALERT("file is not 64bit\n");
         return BFFAILURE;
     }
 
-    if (ef->ehdr->e_ident[bfei_data] != bfelfdata2lsb) {
+    if (ehdr.e_ident[bfei_data] != bfelfdata2lsb) {
         BFALERT("file is not little endian\n");
         return BFFAILURE;
     }
 
-    if (ef->ehdr->e_ident[bfei_version] != bfev_current) {
+    if (ehdr.e_ident[bfei_version] != bfev_current) {
         BFALERT("unsupported version\n");
         return BFFAILURE;
     }
 
-    if (ef->ehdr->e_ident[bfei_osabi] != bfelfosabi_sysv) {
+    if (ehdr.e_ident[bfei_osabi] != bfelfosabi_sysv) {
         BFALERT("file does not use the system v abi\n");
         return BFFAILURE;
     }
 
-    if (ef->ehdr->e_ident[bfei_abiversion] != 0) {
+    if (ehdr.e_ident[bfei_abiversion] != 0) {
         BFALERT("unsupported abi version\n");
         return BFFAILURE;
     }
 
-    if (ef->ehdr->e_machine != bfem_x86_64) {
+    if (ehdr.e_machine != bfem_x86_64) {
         BFALERT("file must be compiled for x86_64 or bfem_aarch64\n");
         return BFFAILURE;
     }
 
-    if (ef->ehdr->e_version != bfev_current) {
+    if (ehdr.e_version != bfev_current) {
         BFALERT("unsupported version\n");
         return BFFAILURE;
     }
 
-    if (ef->ehdr->e_flags != 0) {
+    if (ehdr.e_flags != 0) {
         BFALERT("unsupported flags\n");
         return BFFAILURE;
     }
 
-    for (i = 0; i < ef->ehdr->e_phnum; i++) {
-        const struct bfelf_phdr *phdr = &(private_phdrtab(ef)[i]);
+    for (i = 0; i < ehdr.e_phnum; i++) {
+        if (private_read_phdr(ef, &ehdr, i, &phdr) != BFSUCCESS) {
+            return BFFAILURE;
+        }
 
-        if (phdr->p_type != bfpt_load) {
+        if (phdr.p_type != bfpt_load) {
             continue;
         }
 
-        if (first == nullptr) {
-            first = phdr;
+        if (found == 0) {
+            first = phdr.p_paddr;
+            found = 1;
         }
 
-        ef->size = phdr->p_paddr - first->p_paddr + phdr->p_memsz;
+        ef->size = phdr.p_paddr - first + phdr.p_memsz;
     }
 
     return BFSUCCESS;
 }
 
 static inline status_t
-bfelf_file_load(
-    struct bfelf_file_t *ef,
-    void *exec,
-    status_t (*mark_rx_func)(void *, size_t))
+bfelf_file_init(const void *file, struct bfelf_file_t *ef)
 {
-    bfelf64_half i;
-    const struct bfelf_phdr *first = nullptr;
+    if (file == nullptr) {
+        BFALERT("file == nullptr\n");
+        return BFFAILURE;
+    }
 
     if (ef == nullptr) {
         BFALERT("ef == nullptr\n");
         return BFFAILURE;
     }
 
-    if (ef->size == 0) {
-        BFALERT("ef->size == 0\n");
+    private_memset(ef, 0, sizeof(struct bfelf_file_t));
+    ef->file = BFSCAST(const uint8_t *, file);
+
+    return private_file_init(ef);
+}
+
+static inline status_t
+bfelf_file_init_stream(
+    status_t (*read_func)(bfelf64_off, void *, bfelf64_xword), struct bfelf_file_t *ef)
+{
+    if (read_func == nullptr) {
+        BFALERT("read_func == nullptr\n");
         return BFFAILURE;
     }
 
-    if (exec == nullptr) {
-        BFALERT("exec == nullptr\n");
+    if (ef == nullptr) {
+        BFALERT("ef == nullptr\n");
         return BFFAILURE;
     }
 
-    ef->exec = BFSCAST(uint8_t *, exec);
-    private_memset(ef->exec, 0, ef->size);
+    private_memset(ef, 0, sizeof(struct bfelf_file_t));
+    ef->read = read_func;
 
-    for (i = 0; i < ef->ehdr->e_phnum; i++) {
-        uint8_t *dst;
-        const uint8_t *src;
-        const struct bfelf_phdr *phdr = &(private_phdrtab(ef)[i]);
+    return private_file_init(ef);
+}
 
-        if (phdr->p_type != bfpt_load) {
-            continue;
-        }
+/*
+ * The tables that the loader needs (the relocations, and the init/fini
+ * arrays) are found using the PT_DYNAMIC segment, which, unlike the section
+ * headers, cannot be stripped, and does not require a string compare for
+ * each section.
+ */
+static inline status_t
+private_load_dynamic(
+    struct bfelf_file_t *ef, const struct bfelf_phdr *phdr)
+{
+    bfelf64_xword i;
+    struct bfelf_dyn dyn;
 
-        if (first == nullptr) {
-            first = phdr;
+    for (i = 0; i + sizeof(struct bfelf_dyn) <= phdr->p_filesz; i += sizeof(struct bfelf_dyn)) {
+        if (private_read(ef, phdr->p_offset + i, &dyn, sizeof(struct bfelf_dyn)) != BFSUCCESS) {
+            return BFFAILURE;
         }
 
-        src = ef->file + phdr->p_offset;
-        dst = ef->exec + (phdr->p_paddr - first->p_paddr);
-        private_memcpy(dst, src, phdr->p_filesz);
+        switch (dyn.d_tag) {
+            case bfdt_null:
+                return BFSUCCESS;
 
-        switch(phdr->p_flags) {
-            case bfpf_rx:
-                if (mark_rx_func != nullptr) {
-                    if (mark_rx_func(dst, phdr->p_memsz) != BFSUCCESS) {
-                        return BFFAILURE;
-                    }
-                }
+            case bfdt_rela:
+                ef->rela_array_addr = dyn.d_val;
+                break;
 
+            case bfdt_relasz:
+                ef->rela_array_size = dyn.d_val;
                 break;
 
-            case bfpf_rw:
+            case bfdt_relr:
+                ef->relr_array_addr = dyn.d_val;
                 break;
 
-            default:
-                BFALERT("ELF segments other than RW or RE are not supported\n");
+            case bfdt_relrsz:
+                ef->relr_array_size = dyn.d_val;
+                break;
+
+            case bfdt_init_array:
+                ef->init_array_addr = dyn.d_val;
+                break;
+
+            case bfdt_init_arraysz:
+                ef->init_array_size = dyn.d_val;
+                break;
+
+            case bfdt_fini_array:
+                ef->fini_array_addr = dyn.d_val;
+                break;
+
+            case bfdt_fini_arraysz:
+                ef->fini_array_size = dyn.d_val;
+                break;
+
+            case bfdt_init:
+                BFALERT("ELF file has unsupported dynamic entry: DT_INIT\n");
                 return BFFAILURE;
-        };
+
+            case bfdt_fini:
+                BFALERT("ELF file has unsupported dynamic entry: DT_FINI\n");
+                return BFFAILURE;
+
+            default:
+                break;
+        }
+    }
+
+    return BFSUCCESS;
+}
+
+/*
+ * The .eh_frame section is found using the .eh_frame_hdr section
+ * (PT_GNU_EH_FRAME), which starts with a pointer to .eh_frame. The size of
+ * .eh_frame is not recorded anywhere, and since the ELF file is linked
+ * with -nostdlib, .eh_frame does not end with a terminator either, so the
+ * end of .eh_frame is the end of the FDE that is furthest into it, as
+ * given by the FDE table that follows. The table is read in chunks of
+ * BFELF_EH_FRAME_TABLE_CHUNK entries, and only the length of the furthest
+ * FDE is read, so that a streamed ELF file is not read once per FDE. Only
+ * the encodings that ld uses are supported. If anything else is found,
+ * .eh_frame is left unset, and is found using the section headers instead.
+ */
+
+#define BFELF_EH_FRAME_PTR_ENC 0x1B
+#define BFELF_EH_FRAME_COUNT_ENC 0x03
+#define BFELF_EH_FRAME_TABLE_ENC 0x3B
+#define BFELF_EH_FRAME_TABLE_CHUNK 64
+
+static inline status_t
+private_load_eh_frame(
+    struct bfelf_file_t *ef, const struct bfelf_phdr *phdr)
+{
+    bfelf64_xword i;
+    bfelf64_xword j;
+    bfelf64_addr last = 0;
+    bfelf64_addr eh_frame_addr;
+
+    uint8_t enc[4];
+    int32_t eh_frame_ptr;
+    uint32_t fde_count;
+    int32_t table[BFELF_EH_FRAME_TABLE_CHUNK][2];
+    uint32_t length;
+
+    if (phdr->p_filesz < 12) {
+        return BFSUCCESS;
+    }
+
+    if (private_read(ef, phdr->p_offset, enc, sizeof(enc)) != BFSUCCESS) {
+        return BFFAILURE;
+    }
+
+    if (enc[0] != 1 || enc[1] != BFELF_EH_FRAME_PTR_ENC ||
+        enc[2] != BFELF_EH_FRAME_COUNT_ENC || enc[3] != BFELF_EH_FRAME_TABLE_ENC) {
+        return BFSUCCESS;
+    }
+
+    if (private_read(ef, phdr->p_offset + 4, &eh_frame_ptr, sizeof(eh_frame_ptr)) != BFSUCCESS) {
+        return BFFAILURE;
+    }
+
+    if (private_read(ef, phdr->p_offset + 8, &fde_count, sizeof(fde_count)) != BFSUCCESS) {
+        return BFFAILURE;
+    }
+
+    if (fde_count == 0 || 12 + (BFSCAST(bfelf64_xword, fde_count) * sizeof(table[0])) > phdr->p_filesz) {
+        return BFSUCCESS;
     }
 
-    for (i = 0; i < ef->ehdr->e_shnum; i++) {
-        const struct bfelf_shdr *shdr = &(private_shdrtab(ef)[i]);
-        const char *name = &(private_shstrtab(ef)[shdr->sh_name]);
+    /*
+     * .eh_frame_hdr and .eh_frame are in the same segment, so the offset of
+     * an FDE in the ELF file is its address relative to .eh_frame_hdr. The
+     * table is sorted by PC and not by FDE, so every entry is looked at to
+     * find the FDE with the highest address.
+     */
+
+    eh_frame_addr = phdr->p_vaddr + 4 + BFSCAST(bfelf64_addr, BFSCAST(bfelf64_sxword, eh_frame_ptr));
+
+    for (i = 0; i < fde_count; i += BFELF_EH_FRAME_TABLE_CHUNK) {
+        bfelf64_xword num = fde_count - i;
+
+        if (num > BFELF_EH_FRAME_TABLE_CHUNK) {
+            num = BFELF_EH_FRAME_TABLE_CHUNK;
+        }
+
+        if (private_read(ef, phdr->p_offset + 12 + (i * sizeof(table[0])), table, num * sizeof(table[0])) != BFSUCCESS) {
+            return BFFAILURE;
+        }
+
+        for (j = 0; j < num; j++) {
+            bfelf64_addr fde = phdr->p_vaddr + BFSCAST(bfelf64_addr, BFSCAST(bfelf64_sxword, table[j][1]));
+
+            if (fde < eh_frame_addr) {
+                return BFSUCCESS;
+            }
+
+            if (fde > last) {
+                last = fde;
+            }
+        }
+    }
+
+    if (private_read(ef, phdr->p_offset + (last - phdr->p_vaddr), &length, sizeof(length)) != BFSUCCESS) {
+        return BFFAILURE;
+    }
+
+    if (length == 0xFFFFFFFF) {
+        return BFSUCCESS;
+    }
+
+    ef->eh_frame_addr = eh_frame_addr;
+    ef->eh_frame_size = last + 4 + length - eh_frame_addr;
+
+    return BFSUCCESS;
+}
+
+/*
+ * Finds the same tables as private_load_dynamic and private_load_eh_frame,
+ * using the names of the sections instead.
+ */
+static inline status_t
+private_load_sections(
+    struct bfelf_file_t *ef, const struct bfelf_ehdr *ehdr)
+{
+    bfelf64_half i;
+    struct bfelf_shdr shdr;
+    struct bfelf_shdr shstrtab;
+
+    if (ehdr->e_shoff == 0 || ehdr->e_shnum == 0) {
+        return BFSUCCESS;
+    }
+
+    if (private_read_shdr(ef, ehdr, ehdr->e_shstrndx, &shstrtab) != BFSUCCESS) {
+        return BFFAILURE;
+    }
+
+    for (i = 0; i < ehdr->e_shnum; i++) {
+        char name[16];
+
+        if (private_read_shdr(ef, ehdr, i, &shdr) != BFSUCCESS) {
+            return BFFAILURE;
+        }
+
+        if (private_read_name(ef, &shstrtab, shdr.sh_name, name, sizeof(name)) != BFSUCCESS) {
+            return BFFAILURE;
+        }
 
         if (private_strcmp(name, ".rela.dyn") == BFSUCCESS) {
-            ef->rela_array_addr = shdr->sh_addr;
-            ef->rela_array_size = shdr->sh_size;
+            ef->rela_array_addr = shdr.sh_addr;
+            ef->rela_array_size = shdr.sh_size;
+            continue;
+        }
+
+        if (private_strcmp(name, ".relr.dyn") == BFSUCCESS) {
+            ef->relr_array_addr = shdr.sh_addr;
+            ef->relr_array_size = shdr.sh_size;
             continue;
         }
 
         if (private_strcmp(name, ".init_array") == BFSUCCESS) {
-            ef->init_array_addr = shdr->sh_addr;
-            ef->init_array_size = shdr->sh_size;
+            ef->init_array_addr = shdr.sh_addr;
+            ef->init_array_size = shdr.sh_size;
             continue;
         }
 
         if (private_strcmp(name, ".fini_array") == BFSUCCESS) {
-            ef->fini_array_addr = shdr->sh_addr;
-            ef->fini_array_size = shdr->sh_size;
+            ef->fini_array_addr = shdr.sh_addr;
+            ef->fini_array_size = shdr.sh_size;
             continue;
         }
 
         if (private_strcmp(name, ".eh_frame") == BFSUCCESS) {
-            ef->eh_frame_addr = shdr->sh_addr;
-            ef->eh_frame_size = shdr->sh_size;
+            ef->eh_frame_addr = shdr.sh_addr;
+            ef->eh_frame_size = shdr.sh_size;
             continue;
         }
 
@@ -757,10 +1386,414 @@ bfelf_file_load(
         }
     }
 
-    ef->entry = ef->ehdr->e_entry;
+    return BFSUCCESS;
+}
+
+static inline status_t
+bfelf_file_load(
+    struct bfelf_file_t *ef,
+    void *exec,
+    status_t (*mark_rx_func)(void *, size_t))
+{
+    bfelf64_half i;
+    bfelf64_addr cursor = 0;
+    bfelf64_addr first = 0;
+    uint8_t found = 0;
+
+    bfelf64_addr rw_file_end = 0;
+    bfelf64_addr rw_mem_end = 0;
+    uint8_t rw_found = 0;
+    uint8_t dynamic_found = 0;
+
+    struct bfelf_ehdr ehdr;
+    struct bfelf_phdr phdr;
+
+    if (ef == nullptr) {
+        BFALERT("ef == nullptr\n");
+        return BFFAILURE;
+    }
+
+    if (ef->size == 0) {
+        BFALERT("ef->size == 0\n");
+        return BFFAILURE;
+    }
+
+    if (exec == nullptr) {
+        BFALERT("exec == nullptr\n");
+        return BFFAILURE;
+    }
+
+    if (private_read_ehdr(ef, &ehdr) != BFSUCCESS) {
+        return BFFAILURE;
+    }
+
+    /*
+     * Each byte of the image is written once. The file portion of each
+     * segment is copied, and the rest of the image (the BSS portion of each
+     * segment and the gaps between segments) is zeroed, unless the memory
+     * was already zeroed by the allocator. Segments are marked RX once the
+     * entire image has been written as the gap that follows an RX segment
+     * usually shares a page with it. If a map_file function is provided, RX
+     * segments that are page aligned in the ELF file are mapped instead of
+     * copied, in which case the pages they occupy are not written at all.
+     * If exec is lazy, nothing is written, and only the layout is recorded.
+     */
+
+    ef->exec = BFSCAST(uint8_t *, exec);
+
+    for (i = 0; i < ehdr.e_phnum; i++) {
+        uint8_t *dst;
+        bfelf64_addr offset;
+        bfelf64_xword map_size;
+
+        if (private_read_phdr(ef, &ehdr, i, &phdr) != BFSUCCESS) {
+            return BFFAILURE;
+        }
+
+        if (phdr.p_type == bfpt_gnu_eh_frame) {
+            ef->eh_frame_hdr_addr = phdr.p_vaddr;
+            ef->eh_frame_hdr_size = phdr.p_memsz;
+
+            if (private_load_eh_frame(ef, &phdr) != BFSUCCESS) {
+                return BFFAILURE;
+            }
+
+            continue;
+        }
+
+        if (phdr.p_type == bfpt_dynamic) {
+            if (private_load_dynamic(ef, &phdr) != BFSUCCESS) {
+                return BFFAILURE;
+            }
+
+            dynamic_found = 1;
+            continue;
+        }
+
+        if (phdr.p_type != bfpt_load) {
+            continue;
+        }
+
+        if (found == 0) {
+            first = phdr.p_paddr;
+            found = 1;
+        }
+
+        if (phdr.p_flags != bfpf_rx && phdr.p_flags != bfpf_rw) {
+            BFALERT("ELF segments other than RW or RE are not supported\n");
+            return BFFAILURE;
+        }
+
+        offset = phdr.p_paddr - first;
+        if (phdr.p_filesz > phdr.p_memsz || offset + phdr.p_memsz > ef->size) {
+            BFALERT("ELF segment is outside of the executable\n");
+            return BFFAILURE;
+        }
+
+        dst = ef->exec + offset;
+
+        if (phdr.p_flags == bfpf_rw) {
+            if (rw_found == 0) {
+                ef->rw_offset = offset;
+                rw_found = 1;
+            }
+
+            if (offset + phdr.p_filesz > rw_file_end) {
+                rw_file_end = offset + phdr.p_filesz;
+            }
+
+            if (offset + phdr.p_memsz > rw_mem_end) {
+                rw_mem_end = offset + phdr.p_memsz;
+            }
+        }
+
+        if (ef->exec_lazy != 0) {
+            continue;
+        }
+
+        map_size = private_map_size(ef, &phdr, offset, cursor);
+        if (map_size != 0) {
+            bfelf64_addr lead = phdr.p_offset & (BFELF_PAGE_SIZE - 1);
+
+            if (ef->exec_zeroed == 0 && offset - lead > cursor) {
+                private_load_copy(ef, ef->exec + cursor, nullptr, offset - lead - cursor);
+            }
+
+            if (ef->map_file(dst - lead, phdr.p_offset - lead, map_size) != BFSUCCESS) {
+                BFALERT("failed to map ELF segment\n");
+                return BFFAILURE;
+            }
+
+            cursor = offset - lead + map_size;
+            continue;
+        }
+
+        if (ef->exec_zeroed == 0) {
+            if (offset > cursor) {
+                private_load_copy(ef, ef->exec + cursor, nullptr, offset - cursor);
+            }
+
+            private_load_copy(ef, dst + phdr.p_filesz, nullptr, phdr.p_memsz - phdr.p_filesz);
+        }
+
+        if (private_read(ef, phdr.p_offset, dst, phdr.p_filesz) != BFSUCCESS) {
+            return BFFAILURE;
+        }
+
+        if (offset + phdr.p_memsz > cursor) {
+            cursor = offset + phdr.p_memsz;
+        }
+    }
+
+    if (rw_found != 0) {
+        ef->rw_filesz = rw_file_end - ef->rw_offset;
+        ef->rw_memsz = rw_mem_end - ef->rw_offset;
+    }
+
+    if (ef->exec_zeroed == 0 && ef->exec_lazy == 0 && ef->size > cursor) {
+        private_load_copy(ef, ef->exec + cursor, nullptr, ef->size - cursor);
+    }
+
+    for (i = 0; mark_rx_func != nullptr && i < ehdr.e_phnum; i++) {
+        if (private_read_phdr(ef, &ehdr, i, &phdr) != BFSUCCESS) {
+            return BFFAILURE;
+        }
+
+        if (phdr.p_type != bfpt_load || phdr.p_flags != bfpf_rx) {
+            continue;
+        }
+
+        if (mark_rx_func(ef->exec + (phdr.p_paddr - first), phdr.p_memsz) != BFSUCCESS) {
+            return BFFAILURE;
+        }
+    }
+
+    /*
+     * The section headers are only used if the ELF file does not have a
+     * PT_DYNAMIC segment, or if .eh_frame could not be found using
+     * PT_GNU_EH_FRAME. A stripped ELF file (no section headers) is fine as
+     * long as it does not need them.
+     */
+
+    if (dynamic_found == 0 || ef->eh_frame_addr == 0) {
+        if (private_load_sections(ef, &ehdr) != BFSUCCESS) {
+            return BFFAILURE;
+        }
+    }
+
+    ef->entry = ehdr.e_entry;
 
     ef->file = nullptr;
-    ef->ehdr = nullptr;
+    ef->read = nullptr;
+
+    return BFSUCCESS;
+}
+
+/*
+ * ld places all of the R_X86_64_RELATIVE relocations at the start of
+ * .rela.dyn, so for a static PIE, .rela.dyn is usually one long run of
+ * relative relocations. This function applies the run that starts at
+ * "rela" and returns its length. Relative relocations are the only type
+ * the loader supports, so anything after the run is an error, but since
+ * the loop only has to compare each entry's type, it stays tight even for
+ * images with millions of relocations.
+ */
+static inline bfelf64_xword
+private_relocate_relative(
+    uint8_t *exec,
+    const struct bfelf_rela *rela,
+    bfelf64_xword num,
+    bfelf64_addr virt)
+{
+    bfelf64_xword i;
+
+    for (i = 0; i < num; i++) {
+        if (BFELF_REL_TYPE(rela[i].r_info) != BFR_X86_64_RELATIVE) {
+            break;
+        }
+
+        *BFRCAST(bfelf64_addr *, exec + rela[i].r_offset) += virt;
+    }
+
+    return i;
+}
+
+/*
+ * Since every RELR relocation is a relative relocation, each word of the
+ * table is either the start of a run, or up to 63 relocations, which are
+ * applied without having to look at each relocation's type.
+ *
+ * This function applies the words from "begin" to "end". Since a bitmap
+ * depends on the address before it, a range that does not start at the
+ * beginning of the table starts at its first address, and a range ends at
+ * the first address at or after "end". This way, the table can be split
+ * anywhere, and each word is still applied exactly once.
+ */
+static inline status_t
+private_relocate_relr(
+    struct bfelf_file_t *ef,
+    bfelf64_xword begin,
+    bfelf64_xword end,
+    bfelf64_addr virt)
+{
+    bfelf64_xword i;
+    bfelf64_addr *addr;
+    bfelf64_addr *where = nullptr;
+    const bfelf_relr *relr_table = private_relrtab(ef);
+    bfelf64_xword num = ef->relr_array_size / sizeof(bfelf_relr);
+
+    while (begin != 0 && begin < num && (relr_table[begin] & 1) != 0) {
+        begin++;
+    }
+
+    if (end > num) {
+        end = num;
+    }
+
+    while (end < num && (relr_table[end] & 1) != 0) {
+        end++;
+    }
+
+    for (i = begin; i < end; i++) {
+        bfelf_relr entry = relr_table[i];
+
+        if ((entry & 1) == 0) {
+            where = BFRCAST(bfelf64_addr *, ef->exec + entry);
+            *where++ += virt;
+            continue;
+        }
+
+        if (where == nullptr) {
+            BFALERT("RELR table starts with a bitmap\n");
+            return BFFAILURE;
+        }
+
+        for (addr = where, entry >>= 1; entry != 0; entry >>= 1, addr++) {
+            if ((entry & 1) != 0) {
+                *addr += virt;
+            }
+        }
+
+        where += BFELF_RELR_BITS;
+    }
+
+    return BFSUCCESS;
+}
+
+struct private_parallel_relocate_t {
+    struct bfelf_file_t *ef;
+    bfelf64_xword num;
+    bfelf64_addr virt;
+    uint8_t failed;
+};
+
+static inline void
+private_parallel_set_failed(struct private_parallel_relocate_t *args)
+{
+#ifdef _MSC_VER
+    _InterlockedExchange8(BFRCAST(volatile char *, &args->failed), 1);
+#else
+    __atomic_store_n(&args->failed, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline uint8_t
+private_parallel_failed(struct private_parallel_relocate_t *args)
+{
+#ifdef _MSC_VER
+    return BFSCAST(uint8_t, _InterlockedOr8(BFRCAST(volatile char *, &args->failed), 0));
+#else
+    return __atomic_load_n(&args->failed, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void
+private_parallel_rela_chunk(void *ctx, bfelf64_xword i)
+{
+    struct private_parallel_relocate_t *args = BFSCAST(struct private_parallel_relocate_t *, ctx);
+
+    bfelf64_xword begin = i * BFELF_PARALLEL_RELOCS;
+    bfelf64_xword num = args->num - begin;
+
+    if (num > BFELF_PARALLEL_RELOCS) {
+        num = BFELF_PARALLEL_RELOCS;
+    }
+
+    if (private_relocate_relative(args->ef->exec, &(private_relatab(args->ef)[begin]), num, args->virt) != num) {
+        private_parallel_set_failed(args);
+    }
+}
+
+/*
+ * A RELR word covers up to 63 relocations, so RELR tables are split into
+ * chunks of about BFELF_PARALLEL_RELOCS relocations by splitting them into
+ * chunks of BFELF_PARALLEL_RELOCS / 64 words.
+ */
+static inline void
+private_parallel_relr_chunk(void *ctx, bfelf64_xword i)
+{
+    struct private_parallel_relocate_t *args = BFSCAST(struct private_parallel_relocate_t *, ctx);
+
+    bfelf64_xword begin = i * (BFELF_PARALLEL_RELOCS / 64);
+    bfelf64_xword end = begin + (BFELF_PARALLEL_RELOCS / 64);
+
+    if (private_relocate_relr(args->ef, begin, end, args->virt) != BFSUCCESS) {
+        private_parallel_set_failed(args);
+    }
+}
+
+/*
+ * Applies all of the relocations in .rela.dyn and .relr.dyn, using
+ * ef->parallel_for if there are enough of them to split. A chunk that fails
+ * sets "failed" atomically, which is only ever set to 1, so it does not
+ * matter which thread sets it, and parallel_for does not return until all
+ * of the chunks are done (i.e., the join orders the stores before the load).
+ */
+static inline status_t
+private_relocate_all(
+    struct bfelf_file_t *ef,
+    bfelf64_addr virt)
+{
+    struct private_parallel_relocate_t args;
+
+    bfelf64_xword rela_num = ef->rela_array_size / sizeof(struct bfelf_rela);
+    bfelf64_xword relr_num = ef->relr_array_size / sizeof(bfelf_relr);
+
+    if (ef->parallel_for == nullptr ||
+        (rela_num <= BFELF_PARALLEL_RELOCS && relr_num <= BFELF_PARALLEL_RELOCS / 64)) {
+
+        if (private_relocate_relative(ef->exec, private_relatab(ef), rela_num, virt) != rela_num) {
+            BFALERT("unsupported relocation type\n");
+            return BFFAILURE;
+        }
+
+        return private_relocate_relr(ef, 0, relr_num, virt);
+    }
+
+    args.ef = ef;
+    args.virt = virt;
+    args.failed = 0;
+
+    if (rela_num != 0) {
+        args.num = rela_num;
+        ef->parallel_for(
+            private_parallel_rela_chunk, &args, (rela_num + BFELF_PARALLEL_RELOCS - 1) / BFELF_PARALLEL_RELOCS);
+
+        if (private_parallel_failed(&args) != 0) {
+            BFALERT("unsupported relocation type\n");
+            return BFFAILURE;
+        }
+    }
+
+    if (relr_num != 0) {
+        args.num = relr_num;
+        ef->parallel_for(
+            private_parallel_relr_chunk, &args, (relr_num + (BFELF_PARALLEL_RELOCS / 64) - 1) / (BFELF_PARALLEL_RELOCS / 64));
+
+        if (private_parallel_failed(&args) != 0) {
+            return BFFAILURE;
+        }
+    }
 
     return BFSUCCESS;
 }
@@ -770,15 +1803,14 @@ bfelf_file_relocate(
     struct bfelf_file_t *ef,
     bfelf64_addr virt)
 {
-    bfelf64_half i;
-    const struct bfelf_rela *rela_table;
+    bfelf64_addr delta;
 
     if (ef == nullptr) {
         BFALERT("ef == nullptr\n");
         return BFFAILURE;
     }
 
-    if (ef->rela_array_addr == 0) {
+    if (ef->rela_array_addr == 0 && ef->relr_array_addr == 0) {
         BFALERT("ELF file is not relocatable\n");
         return BFFAILURE;
     }
@@ -796,37 +1828,56 @@ bfelf_file_relocate(
         ef->exec = BFRCAST(uint8_t *, virt);
     }
 
-    for (i = 0; i < ef->rela_array_size / sizeof(struct bfelf_rela); i++) {
-        const struct bfelf_rela *rela = &(private_relatab(ef)[i]);
+    /*
+     * If the ELF file was already relocated (e.g., by bfcompile for a fixed
+     * base address), there is nothing to do if it will run from the same
+     * address. Otherwise, since every relocation is relative, moving it is
+     * the same as relocating it by the difference between the addresses.
+     */
 
-        switch (BFELF_REL_TYPE(rela->r_info)) {
-            case BFR_X86_64_RELATIVE: {
-                bfelf64_addr *addr =
-                    BFRCAST(bfelf64_addr *, ef->exec + rela->r_offset);
+    if (ef->relocated != 0) {
+        if (virt == ef->base) {
+            return BFSUCCESS;
+        }
 
-                *addr += virt;
-                break;
-            }
+        delta = virt - ef->base;
+    }
+    else {
+        delta = virt;
+    }
 
-            default:
-                BFALERT("unsupported relocation type\n");
-                return BFFAILURE;
-        }
+    /*
+     * If exec is lazy, its pages (and the relocations that fall in them) are
+     * filled in by the caller as they are touched, so only the addresses in
+     * the bfelf_file_t are relocated here.
+     */
+
+    if (ef->exec_lazy == 0 && private_relocate_all(ef, delta) != BFSUCCESS) {
+        return BFFAILURE;
     }
 
     if (ef->init_array_addr != 0) {
-        ef->init_array_addr += virt;
+        ef->init_array_addr += delta;
     }
 
     if (ef->fini_array_addr != 0) {
-        ef->fini_array_addr += virt;
+        ef->fini_array_addr += delta;
     }
 
     if (ef->eh_frame_addr != 0) {
-        ef->eh_frame_addr += virt;
+        ef->eh_frame_addr += delta;
+    }
+
+    if (ef->eh_frame_hdr_addr != 0) {
+        ef->eh_frame_hdr_addr += delta;
+    }
+
+    if (ef->unwind_table_addr != 0) {
+        ef->unwind_table_addr += delta;
     }
 
-    ef->entry += virt;
+    ef->entry += delta;
+    ef->base = virt;
     ef->relocated = 1;
 
     return BFSUCCESS;
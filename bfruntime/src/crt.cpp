@@ -21,12 +21,16 @@
 
 #include <bftypes.h>
 #include <bfstart.h>
+#include <bfheap.h>
+#include <bfheapstats.h>
 #include <bfehframelist.h>
 #include <bfthreadcontext.h>
 #include <bfweak.h>
 #include <bfsyscall.h>
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <iostream>
 
 // -----------------------------------------------------------------------------
@@ -40,6 +44,17 @@ uint8_t *__g_heap = {};
 uint64_t __g_heap_size = {};
 uint8_t *__g_heap_cursor = {};
 
+void *(*__g_alloc)(size_t size) = {};
+void (*__g_free)(void *ptr, size_t size) = {};
+
+heap_stats_t *__g_heap_stats_out = {};
+
+extern "C" void _heap_init(void) noexcept;
+extern "C" void _unwind_heap_reset(void) noexcept;
+
+static bool g_started = false;
+static bfheap_checkpoint_t g_checkpoint = {};
+
 // -----------------------------------------------------------------------------
 // Main Functions
 // -----------------------------------------------------------------------------
@@ -59,16 +74,45 @@ main(int argc, const char *argv[])
 
 extern "C" void
 _set_original_sp(uint64_t sp)
-{ thread_context_ptr(__tc_tocs())->original_sp = sp; }
+{ thread_context_cur()->original_sp = sp; }
 
 extern "C" uint64_t
 _get_original_sp(void)
-{ return thread_context_ptr(__tc_tocs())->original_sp; }
+{ return thread_context_cur()->original_sp; }
 
 // -----------------------------------------------------------------------------
 // Implementation
 // -----------------------------------------------------------------------------
 
+// If _start_args_t::heap_reset is set, the application is started once,
+// and then resumed on every call to _start after that (the loader does not
+// restore its RW segments). A checkpoint of the heap is taken once static
+// initialization is complete, and each time the application is resumed,
+// the heap is reset to this checkpoint (and a new one is taken, as a
+// checkpoint can only be reset once) and main() is called again. Since
+// the application is resumed, exit() cannot be used as it would run the
+// global destructors, so stdio is flushed and _exit() is used instead.
+//
+// Note that stdout's buffer is allocated before the checkpoint is taken,
+// as newlib would otherwise allocate it during the first call to main(),
+// and the heap cannot grow until the checkpoint is taken, as the chunks
+// are given back when the application returns. The unwinder's caches that
+// are allocated lazily (on the first throw) are forgotten on every reset
+// (see _unwind_heap_reset), but any other state that the application (or
+// newlib) initializes lazily during main() and keeps in its RW segments,
+// such as function-local statics and FILEs opened with fopen(), is left
+// pointing to freed memory by the reset, and must not be used by the next
+// run.
+
+[[noreturn]] static void
+private_resumable_main(const _start_args_t *info)
+{
+    auto ret = main(info->argc, info->argv);
+
+    fflush(nullptr);
+    _exit(ret);
+}
+
 extern "C" status_t
 _start_c(const _start_args_t *info) noexcept
 {
@@ -76,13 +120,37 @@ _start_c(const _start_args_t *info) noexcept
 
     __g_eh_frame = {
         reinterpret_cast<void *>(info->eh_frame_addr),
-        info->eh_frame_size
+        info->eh_frame_size,
+        reinterpret_cast<void *>(info->eh_frame_hdr_addr),
+        info->eh_frame_hdr_size,
+        reinterpret_cast<void *>(info->unwind_table_addr),
+        info->unwind_table_size
     };
 
+    __g_syscall = info->syscall;
+    __g_heap_stats_out = info->heap_stats;
+
+    if (info->heap_reset != 0 && g_started) {
+        __g_alloc = info->alloc;
+        __g_free = info->free;
+
+        bfheap_reset(&g_checkpoint);
+        bfheap_checkpoint(&g_checkpoint);
+        _unwind_heap_reset();
+
+        private_resumable_main(info);
+    }
+
     __g_heap = static_cast<uint8_t *>(info->heap);
     __g_heap_size = info->heap_size;
     __g_heap_cursor = static_cast<uint8_t *>(info->heap);
-    __g_syscall = info->syscall;
+
+    if (info->heap_reset == 0) {
+        __g_alloc = info->alloc;
+        __g_free = info->free;
+    }
+
+    _heap_init();
 
     std::ios_base::Init mInitializer;
 
@@ -93,6 +161,17 @@ _start_c(const _start_args_t *info) noexcept
         }
     }
 
+    if (info->heap_reset != 0) {
+        setvbuf(stdout, nullptr, _IOLBF, BUFSIZ);
+        bfheap_checkpoint(&g_checkpoint);
+
+        __g_alloc = info->alloc;
+        __g_free = info->free;
+
+        g_started = true;
+        private_resumable_main(info);
+    }
+
     exit(main(info->argc, info->argv));
 
     // Only needed for debugging
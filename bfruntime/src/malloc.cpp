@@ -0,0 +1,1424 @@
+//
+// Copyright (C) 2019 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// TIDY_EXCLUSION=-cppcoreguidelines-pro*
+//
+// Reason:
+//     Although written in C++, this code needs to implement C specific logic
+//     that by its very definition will not adhere to the core guidelines
+//     similar to libc which is needed by all C++ implementations.
+//
+
+#include <new>
+#include <cerrno>
+#include <cstring>
+
+#include <malloc.h>
+#include <unistd.h>
+
+#include <bfheap.h>
+#include <bfheapstats.h>
+#include <bftypes.h>
+#include <bfweak.h>
+
+extern uint8_t *__g_heap;
+extern uint64_t __g_heap_size;
+extern uint8_t *__g_heap_cursor;
+
+extern void *(*__g_alloc)(size_t size);
+extern void (*__g_free)(void *ptr, size_t size);
+
+extern struct heap_stats_t *__g_heap_stats_out;
+
+struct heap_stats_t __g_heap_stats = {};
+
+struct _reent;
+
+#ifndef BFNEWLIB_MALLOC
+
+// -----------------------------------------------------------------------------
+// Overview
+// -----------------------------------------------------------------------------
+
+// The heap is managed in pages that are taken from the top of the heap
+// using sbrk(). A run of pages is called a span, and every span is
+// described by a span_t that lives outside of the span. The page map has
+// one entry for every page in the heap and is used to find the span_t
+// that a pointer belongs to, which is how free() and realloc() know how
+// big an allocation is without storing a header in front of it.
+//
+// Allocations up to HEAP_MAX_SMALL bytes are rounded up to one of the size
+// classes (16 byte steps up to 128 bytes, then 4 classes per power of two)
+// and are served from a slab: a span that is divided into objects of one
+// size class. Each size class has a list of slabs that have free objects,
+// so both malloc and free are O(1). A slab that becomes empty is given back
+// to the page heap, unless it is the only slab left in its list.
+//
+// Larger allocations get their own span. Free spans are kept in bins by
+// their number of pages (with one bin for everything that is larger) and
+// are merged with the spans next to them when they are freed. If a free
+// span ends at the top of the heap, it is given back to sbrk() instead.
+//
+// Slabs start on a page boundary, so an object whose size class is a
+// multiple of a power of two (up to the page size) is aligned to it, which
+// is how aligned allocations are served from the slabs. Larger alignments
+// are served by trimming a span (see private_large_alloc).
+//
+// Once sbrk() runs out of memory, the heap grows by asking the loader for
+// another chunk of memory using the alloc function in _start_args_t (see
+// private_heap_grow). Each chunk has its own page map and is given to the
+// page heap as one free span, so spans never cross from one chunk into
+// another. Chunks are at least as big as the memory the heap already has,
+// which keeps the number of chunks (and the cost of finding the chunk a
+// pointer belongs to) small. The chunks are given back to the loader when
+// the application exits (see _heap_fini).
+//
+// A checkpoint seals the heap as it is and sets its free memory aside (see
+// bfheap_checkpoint), so that everything allocated after it can be freed
+// at once by moving the sbrk() cursor back, freeing the chunks that were
+// added since and putting the free memory back.
+//
+// A single lock protects the heap. There is no per-thread cache as the
+// runtime is usually executed by one thread at a time.
+
+#define HEAP_PAGE_SHIFT 12
+#define HEAP_PAGE_SIZE (1ULL << HEAP_PAGE_SHIFT)
+#define HEAP_MAX_SMALL 16384
+#define HEAP_NUM_CLASSES BFHEAP_NUM_CLASSES
+#define HEAP_MAX_SLAB_PAGES 16
+#define HEAP_NUM_BINS BFHEAP_NUM_BINS
+#define HEAP_MIN_CHUNK_PAGES 256
+#define HEAP_MAX_ALLOC (1ULL << 47)
+
+// -----------------------------------------------------------------------------
+// Statistics
+// -----------------------------------------------------------------------------
+
+// The counters are only changed while the heap is locked, but they are
+// changed using relaxed atomic loads and stores so that the application can
+// read them at any time (see bfheapstats.h). Since the lock is held, there
+// is no need for a locked read-modify-write, which would more than double
+// the cost of a small allocation.
+
+static inline void
+private_stats_add(uint64_t *counter, uint64_t value)
+{ __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED); }
+
+static inline void
+private_stats_peak(uint64_t *peak, const uint64_t *counter)
+{
+    auto value = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+    if (value > __atomic_load_n(peak, __ATOMIC_RELAXED)) {
+        __atomic_store_n(peak, value, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void
+private_stats_alloc(uint64_t cls, uint64_t size)
+{
+    private_stats_add(&__g_heap_stats.class_allocs[cls], 1);
+    private_stats_add(&__g_heap_stats.total_bytes, size);
+    private_stats_add(&__g_heap_stats.current_bytes, size);
+    private_stats_peak(&__g_heap_stats.peak_bytes, &__g_heap_stats.current_bytes);
+}
+
+static inline void
+private_stats_free(uint64_t size)
+{ private_stats_add(&__g_heap_stats.current_bytes, -size); }
+
+static inline void
+private_stats_heap(uint64_t size)
+{
+    private_stats_add(&__g_heap_stats.heap_bytes, size);
+    private_stats_peak(&__g_heap_stats.peak_heap_bytes, &__g_heap_stats.heap_bytes);
+}
+
+// -----------------------------------------------------------------------------
+// Spans
+// -----------------------------------------------------------------------------
+
+enum span_state {
+    span_free = 0,
+    span_small = 1,
+    span_large = 2
+};
+
+struct span_t;
+
+struct chunk_t {
+    uint64_t base;
+    uint64_t end;
+    uint64_t seal;
+    span_t **pagemap;
+    chunk_t *next;
+
+    void *ptr;
+    uint64_t size;
+};
+
+struct span_t {
+    uint64_t start;
+    uint64_t npages;
+    span_t *next;
+    span_t *prev;
+    chunk_t *chunk;
+
+    void *free_list;
+    uint64_t carve;
+    uint64_t limit;
+
+    uint32_t state;
+    uint32_t cls;
+    uint64_t used;
+};
+
+static chunk_t g_heap = {};
+static chunk_t *g_chunks = nullptr;
+static chunk_t *g_sealed_chunks = nullptr;
+static uint64_t g_grow_pages = 0;
+static void *g_deferred = nullptr;
+
+static span_t *g_spare_spans = nullptr;
+static span_t *g_bins[HEAP_NUM_BINS] = {};
+static uint64_t g_bins_used[HEAP_NUM_BINS / 64] = {};
+
+static span_t *g_slabs[HEAP_NUM_CLASSES] = {};
+static uint64_t g_class_size[HEAP_NUM_CLASSES] = {};
+static uint64_t g_class_pages[HEAP_NUM_CLASSES] = {};
+
+static int64_t g_heap_lock = 0;
+
+static inline void
+private_lock()
+{
+    while (__sync_lock_test_and_set(&g_heap_lock, 1) != 0) {
+        while (__atomic_load_n(&g_heap_lock, __ATOMIC_RELAXED) != 0) { }
+    }
+}
+
+static inline void
+private_unlock()
+{ __sync_lock_release(&g_heap_lock); }
+
+// The top of the heap given to _start() is the sbrk() cursor, while the
+// chunks are always fully owned by the page heap.
+
+static inline uint64_t
+private_top(const chunk_t *chunk)
+{
+    if (chunk == &g_heap) {
+        return reinterpret_cast<uint64_t>(__g_heap_cursor);
+    }
+
+    return chunk->end;
+}
+
+static inline uint64_t
+private_span_end(const span_t *span)
+{ return span->start + (span->npages << HEAP_PAGE_SHIFT); }
+
+static inline span_t *&
+private_pagemap(const chunk_t *chunk, uint64_t addr)
+{ return chunk->pagemap[(addr - chunk->base) >> HEAP_PAGE_SHIFT]; }
+
+static inline bool
+private_chunk_has(const chunk_t *chunk, uint64_t addr)
+{ return addr - chunk->base < chunk->end - chunk->base; }
+
+static inline span_t *
+private_span_of(const void *ptr)
+{
+    auto addr = reinterpret_cast<uint64_t>(ptr);
+
+    if (private_chunk_has(&g_heap, addr)) {
+        return private_pagemap(&g_heap, addr);
+    }
+
+    for (auto chunk = g_chunks; chunk != nullptr; chunk = chunk->next) {
+        if (private_chunk_has(chunk, addr)) {
+            return private_pagemap(chunk, addr);
+        }
+    }
+
+    return nullptr;
+}
+
+static uint64_t
+private_sbrk(uint64_t size)
+{
+    auto ptr = sbrk(static_cast<ptrdiff_t>(size));
+    if (ptr == reinterpret_cast<void *>(-1)) {
+        return 0;
+    }
+
+    private_stats_heap(size);
+    return reinterpret_cast<uint64_t>(ptr);
+}
+
+static inline void
+private_list_push(span_t **head, span_t *span)
+{
+    span->prev = nullptr;
+    span->next = *head;
+
+    if (*head != nullptr) {
+        (*head)->prev = span;
+    }
+
+    *head = span;
+}
+
+static inline void
+private_list_remove(span_t **head, span_t *span)
+{
+    if (span->prev != nullptr) {
+        span->prev->next = span->next;
+    }
+    else {
+        *head = span->next;
+    }
+
+    if (span->next != nullptr) {
+        span->next->prev = span->prev;
+    }
+}
+
+static inline void
+private_span_delete(span_t *span)
+{
+    span->next = g_spare_spans;
+    g_spare_spans = span;
+}
+
+static inline void
+private_spans_add(uint64_t page)
+{
+    auto spans = reinterpret_cast<span_t *>(page);
+    for (auto i = 0ULL; i < HEAP_PAGE_SIZE / sizeof(span_t); i++) {
+        private_span_delete(&spans[i]);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Page Heap
+// -----------------------------------------------------------------------------
+
+static inline uint64_t
+private_bin(uint64_t npages)
+{ return npages < HEAP_NUM_BINS ? npages : 0; }
+
+static void
+private_bins_insert(span_t *span)
+{
+    auto bin = private_bin(span->npages);
+
+    span->state = span_free;
+    private_list_push(&g_bins[bin], span);
+
+    if (bin != 0) {
+        g_bins_used[bin >> 6] |= 1ULL << (bin & 63);
+    }
+
+    private_pagemap(span->chunk, span->start) = span;
+    private_pagemap(span->chunk, private_span_end(span) - HEAP_PAGE_SIZE) = span;
+}
+
+static void
+private_bins_remove(span_t *span)
+{
+    auto bin = private_bin(span->npages);
+    private_list_remove(&g_bins[bin], span);
+
+    if (bin != 0 && g_bins[bin] == nullptr) {
+        g_bins_used[bin >> 6] &= ~(1ULL << (bin & 63));
+    }
+}
+
+static span_t *
+private_bins_find(uint64_t npages)
+{
+    if (npages < HEAP_NUM_BINS) {
+        for (auto i = npages >> 6; i < HEAP_NUM_BINS / 64; i++) {
+            auto used = g_bins_used[i];
+
+            if (i == npages >> 6) {
+                used &= ~0ULL << (npages & 63);
+            }
+
+            if (used != 0) {
+                return g_bins[(i << 6) + static_cast<uint64_t>(__builtin_ctzll(used))];
+            }
+        }
+    }
+
+    span_t *best = nullptr;
+    for (auto span = g_bins[0]; span != nullptr; span = span->next) {
+        if (span->npages >= npages && (best == nullptr || span->npages < best->npages)) {
+            best = span;
+        }
+    }
+
+    return best;
+}
+
+// A chunk starts with its chunk_t and its page map, followed by one page
+// of span_t structures (so that giving the chunk to the page heap never
+// needs a span_t that does not exist yet), and the rest of the chunk is a
+// free span. The page map covers the whole chunk, and the entries for the
+// pages in front of the free span are left cleared.
+
+static bool
+private_heap_grow(uint64_t npages)
+{
+    if (__g_alloc == nullptr) {
+        return false;
+    }
+
+    auto total = npages > g_grow_pages ? npages : g_grow_pages;
+    auto reserved = 0ULL;
+
+    while (true) {
+        auto bytes = sizeof(chunk_t) + (total * sizeof(span_t *));
+        reserved = ((bytes + HEAP_PAGE_SIZE - 1) >> HEAP_PAGE_SHIFT) + 1;
+
+        if (total >= npages + reserved) {
+            break;
+        }
+
+        total = npages + reserved;
+    }
+
+    auto size = total << HEAP_PAGE_SHIFT;
+
+    auto ptr = __g_alloc(size);
+    if (ptr == nullptr) {
+        return false;
+    }
+
+    auto base = (reinterpret_cast<uint64_t>(ptr) + HEAP_PAGE_SIZE - 1) & ~(HEAP_PAGE_SIZE - 1);
+    auto end = (reinterpret_cast<uint64_t>(ptr) + size) & ~(HEAP_PAGE_SIZE - 1);
+
+    if (end - base < (npages + reserved) << HEAP_PAGE_SHIFT) {
+        if (__g_free != nullptr) {
+            __g_free(ptr, size);
+        }
+
+        return false;
+    }
+
+    auto chunk = reinterpret_cast<chunk_t *>(base);
+
+    chunk->base = base;
+    chunk->end = end;
+    chunk->seal = 0;
+    chunk->pagemap = reinterpret_cast<span_t **>(base + sizeof(chunk_t));
+    chunk->next = g_chunks;
+    chunk->ptr = ptr;
+    chunk->size = size;
+
+    memset(chunk->pagemap, 0, ((end - base) >> HEAP_PAGE_SHIFT) * sizeof(span_t *));
+    private_spans_add(base + ((reserved - 1) << HEAP_PAGE_SHIFT));
+
+    auto span = g_spare_spans;
+    g_spare_spans = span->next;
+
+    span->start = base + (reserved << HEAP_PAGE_SHIFT);
+    span->npages = ((end - base) >> HEAP_PAGE_SHIFT) - reserved;
+    span->chunk = chunk;
+
+    g_chunks = chunk;
+    g_grow_pages += total;
+
+    private_stats_heap(size);
+    private_stats_add(&__g_heap_stats.chunks, 1);
+
+    private_bins_insert(span);
+    return true;
+}
+
+// The span_t structures are allocated a page at a time. The page is taken
+// from sbrk() if possible, and otherwise from the end of a free span (or
+// from a new chunk). These pages are not part of any span, so their page
+// map entries are cleared, which keeps free spans from being merged into
+// them.
+
+static bool
+private_spans_grow()
+{
+    if (g_heap.pagemap != nullptr) {
+        if (auto page = private_sbrk(HEAP_PAGE_SIZE); page != 0) {
+            private_pagemap(&g_heap, page) = nullptr;
+            private_spans_add(page);
+
+            return true;
+        }
+    }
+
+    auto span = private_bins_find(1);
+    if (span == nullptr) {
+        return private_heap_grow(1);
+    }
+
+    private_bins_remove(span);
+
+    auto page = private_span_end(span) - HEAP_PAGE_SIZE;
+    private_pagemap(span->chunk, page) = nullptr;
+
+    if (--span->npages != 0) {
+        private_bins_insert(span);
+    }
+    else {
+        private_span_delete(span);
+    }
+
+    private_spans_add(page);
+    return true;
+}
+
+static span_t *
+private_span_new()
+{
+    if (g_spare_spans == nullptr && !private_spans_grow()) {
+        return nullptr;
+    }
+
+    auto span = g_spare_spans;
+    g_spare_spans = span->next;
+
+    return span;
+}
+
+static span_t *
+private_page_alloc(uint64_t npages)
+{
+    auto span = private_bins_find(npages);
+
+    if (span == nullptr && g_heap.pagemap != nullptr) {
+        if (span = private_span_new(); span == nullptr) {
+            return nullptr;
+        }
+
+        if (span->start = private_sbrk(npages << HEAP_PAGE_SHIFT); span->start != 0) {
+            span->npages = npages;
+            span->chunk = &g_heap;
+
+            return span;
+        }
+
+        private_span_delete(span);
+        span = nullptr;
+    }
+
+    if (span == nullptr) {
+        if (!private_heap_grow(npages)) {
+            return nullptr;
+        }
+
+        span = private_bins_find(npages);
+    }
+
+    private_bins_remove(span);
+
+    if (span->npages > npages) {
+        if (auto rest = private_span_new(); rest != nullptr) {
+            rest->start = span->start + (npages << HEAP_PAGE_SHIFT);
+            rest->npages = span->npages - npages;
+            rest->chunk = span->chunk;
+            span->npages = npages;
+
+            private_bins_insert(rest);
+        }
+    }
+
+    return span;
+}
+
+static void
+private_page_free(span_t *span)
+{
+    auto chunk = span->chunk;
+
+    if (span->start > chunk->base && span->start > chunk->seal) {
+        auto prev = private_pagemap(chunk, span->start - HEAP_PAGE_SIZE);
+
+        if (prev != nullptr && prev->state == span_free) {
+            private_bins_remove(prev);
+
+            span->start = prev->start;
+            span->npages += prev->npages;
+
+            private_span_delete(prev);
+        }
+    }
+
+    if (private_span_end(span) < private_top(chunk)) {
+        auto next = private_pagemap(chunk, private_span_end(span));
+
+        if (next != nullptr && next->state == span_free) {
+            private_bins_remove(next);
+
+            span->npages += next->npages;
+            private_span_delete(next);
+        }
+    }
+
+    if (chunk == &g_heap && private_span_end(span) == private_top(chunk)) {
+        private_sbrk(-(span->npages << HEAP_PAGE_SHIFT));
+        private_span_delete(span);
+
+        return;
+    }
+
+    private_bins_insert(span);
+}
+
+// -----------------------------------------------------------------------------
+// Size Classes
+// -----------------------------------------------------------------------------
+
+static inline uint64_t
+private_size_to_class(uint64_t size)
+{
+    if (size <= 128) {
+        return size == 0 ? 1 : (size + 15) >> 4;
+    }
+
+    auto bits = size - 1;
+    auto lg = static_cast<uint64_t>(63 - __builtin_clzll(bits));
+
+    return 9 + ((lg - 7) << 2) + ((bits >> (lg - 2)) & 3);
+}
+
+static constexpr uint64_t
+private_class_to_size(uint64_t cls)
+{
+    if (cls <= 8) {
+        return cls << 4;
+    }
+
+    return (5 + ((cls - 9) & 3)) << (5 + ((cls - 9) >> 2));
+}
+
+static_assert(private_class_to_size(HEAP_NUM_CLASSES - 1) == HEAP_MAX_SMALL);
+
+// The number of pages in a slab is the smallest number of pages that wastes
+// no more than 1/8 of the slab at its end.
+
+static uint64_t
+private_class_pages(uint64_t size)
+{
+    auto npages = 1ULL;
+
+    for (; npages < HEAP_MAX_SLAB_PAGES; npages++) {
+        auto bytes = npages << HEAP_PAGE_SHIFT;
+        if (bytes >= size && (bytes % size) * 8 <= bytes) {
+            break;
+        }
+    }
+
+    return npages;
+}
+
+// -----------------------------------------------------------------------------
+// Slabs
+// -----------------------------------------------------------------------------
+
+static span_t *
+private_slab_new(uint64_t cls)
+{
+    auto span = private_page_alloc(g_class_pages[cls]);
+    if (span == nullptr) {
+        return nullptr;
+    }
+
+    auto size = g_class_size[cls];
+
+    span->state = span_small;
+    span->cls = static_cast<uint32_t>(cls);
+    span->used = 0;
+    span->free_list = nullptr;
+    span->carve = span->start;
+    span->limit = span->start + ((span->npages << HEAP_PAGE_SHIFT) / size) * size;
+
+    for (auto page = span->start; page < private_span_end(span); page += HEAP_PAGE_SIZE) {
+        private_pagemap(span->chunk, page) = span;
+    }
+
+    private_list_push(&g_slabs[cls], span);
+    return span;
+}
+
+static inline bool
+private_slab_full(const span_t *span)
+{ return span->free_list == nullptr && span->carve == span->limit; }
+
+static void *
+private_small_alloc(uint64_t cls)
+{
+    auto span = g_slabs[cls];
+
+    if (span == nullptr) {
+        if (span = private_slab_new(cls); span == nullptr) {
+            return nullptr;
+        }
+    }
+
+    void *ptr = span->free_list;
+
+    if (ptr != nullptr) {
+        span->free_list = *static_cast<void **>(ptr);
+    }
+    else {
+        ptr = reinterpret_cast<void *>(span->carve);
+        span->carve += g_class_size[cls];
+    }
+
+    span->used++;
+
+    if (private_slab_full(span)) {
+        private_list_remove(&g_slabs[cls], span);
+    }
+
+    private_stats_alloc(cls, g_class_size[cls]);
+    return ptr;
+}
+
+static void
+private_small_free(span_t *span, void *ptr)
+{
+    auto cls = span->cls;
+
+    if (private_slab_full(span)) {
+        private_list_push(&g_slabs[cls], span);
+    }
+
+    *static_cast<void **>(ptr) = span->free_list;
+    span->free_list = ptr;
+    span->used--;
+
+    private_stats_free(g_class_size[cls]);
+
+    if (span->used == 0 && g_slabs[cls]->next != nullptr) {
+        private_list_remove(&g_slabs[cls], span);
+        private_page_free(span);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Large Allocations
+// -----------------------------------------------------------------------------
+
+static inline void
+private_large_set(span_t *span)
+{
+    span->state = span_large;
+    span->cls = 0;
+
+    private_pagemap(span->chunk, span->start) = span;
+    private_pagemap(span->chunk, private_span_end(span) - HEAP_PAGE_SIZE) = span;
+}
+
+// If the alignment is larger than a page, a span that is large enough to
+// hold an aligned run of pages is allocated, and the pages in front of and
+// behind the aligned run are given back to the page heap right away. The
+// alignment only costs a bigger search, and not memory.
+
+static void *
+private_large_alloc(uint64_t size, uint64_t alignment)
+{
+    if (size > HEAP_MAX_ALLOC || alignment > HEAP_MAX_ALLOC) {
+        return nullptr;
+    }
+
+    auto npages = size != 0 ? (size + HEAP_PAGE_SIZE - 1) >> HEAP_PAGE_SHIFT : 1;
+    auto extra = alignment > HEAP_PAGE_SIZE ? (alignment >> HEAP_PAGE_SHIFT) - 1 : 0;
+
+    auto span = private_page_alloc(npages + extra);
+    if (span == nullptr) {
+        return nullptr;
+    }
+
+    private_large_set(span);
+
+    if (auto start = (span->start + alignment - 1) & ~(alignment - 1); start != span->start) {
+        auto head = private_span_new();
+        if (head == nullptr) {
+            private_page_free(span);
+            return nullptr;
+        }
+
+        head->start = span->start;
+        head->chunk = span->chunk;
+        head->npages = (start - span->start) >> HEAP_PAGE_SHIFT;
+        span->start = start;
+        span->npages -= head->npages;
+
+        private_large_set(span);
+        private_page_free(head);
+    }
+
+    if (span->npages > npages) {
+        if (auto tail = private_span_new(); tail != nullptr) {
+            tail->start = span->start + (npages << HEAP_PAGE_SHIFT);
+            tail->chunk = span->chunk;
+            tail->npages = span->npages - npages;
+            span->npages = npages;
+
+            private_large_set(span);
+            private_page_free(tail);
+        }
+    }
+
+    private_stats_alloc(0, span->npages << HEAP_PAGE_SHIFT);
+    return reinterpret_cast<void *>(span->start);
+}
+
+// -----------------------------------------------------------------------------
+// Implementation
+// -----------------------------------------------------------------------------
+
+static void *
+private_malloc(uint64_t size)
+{
+    void *ptr;
+
+    private_lock();
+
+    if (size <= HEAP_MAX_SMALL) {
+        ptr = private_small_alloc(private_size_to_class(size));
+    }
+    else {
+        ptr = private_large_alloc(size, HEAP_PAGE_SIZE);
+    }
+
+    private_unlock();
+
+    if (ptr == nullptr) {
+        errno = ENOMEM;
+    }
+
+    return ptr;
+}
+
+// Returns the smallest size class that fits "size" and is a multiple of
+// "alignment". The largest size class is a multiple of the page size, so
+// there always is one if size <= HEAP_MAX_SMALL and alignment is a power
+// of two that is no larger than a page.
+
+static uint64_t
+private_aligned_class(uint64_t size, uint64_t alignment)
+{
+    auto cls = private_size_to_class(size > alignment ? size : alignment);
+
+    while ((g_class_size[cls] & (alignment - 1)) != 0) {
+        cls++;
+    }
+
+    return cls;
+}
+
+static void *
+private_memalign(uint64_t alignment, uint64_t size)
+{
+    void *ptr;
+
+    if (alignment <= 16) {
+        return private_malloc(size);
+    }
+
+    private_lock();
+
+    if (alignment <= HEAP_PAGE_SIZE && size <= HEAP_MAX_SMALL) {
+        ptr = private_small_alloc(private_aligned_class(size, alignment));
+    }
+    else {
+        ptr = private_large_alloc(size, alignment);
+    }
+
+    private_unlock();
+
+    if (ptr == nullptr) {
+        errno = ENOMEM;
+    }
+
+    return ptr;
+}
+
+// Memory that is sealed by a checkpoint cannot be given back to the heap
+// until the checkpoint is reset, so it is put on the deferred list instead
+// (which uses the memory itself), and bfheap_reset() frees it again.
+
+static void
+private_free_locked(void *ptr)
+{
+    auto span = private_span_of(ptr);
+    if (span == nullptr) {
+        return;
+    }
+
+    if (span->start < span->chunk->seal) {
+        *static_cast<void **>(ptr) = g_deferred;
+        g_deferred = ptr;
+
+        return;
+    }
+
+    if (span->state == span_small) {
+        private_small_free(span, ptr);
+    }
+    else if (span->state == span_large) {
+        private_stats_free(span->npages << HEAP_PAGE_SHIFT);
+        private_page_free(span);
+    }
+}
+
+static void
+private_free(void *ptr)
+{
+    private_lock();
+    private_free_locked(ptr);
+    private_unlock();
+}
+
+static uint64_t
+private_usable_size(const void *ptr)
+{
+    uint64_t size = 0;
+
+    private_lock();
+
+    if (auto span = private_span_of(ptr); span != nullptr) {
+        if (span->state == span_small) {
+            size = g_class_size[span->cls];
+        }
+        else if (span->state == span_large) {
+            size = span->npages << HEAP_PAGE_SHIFT;
+        }
+    }
+
+    private_unlock();
+    return size;
+}
+
+// Gives the chunks that were added after "last" back to the loader.
+
+static void
+private_chunks_free(const chunk_t *last)
+{
+    while (g_chunks != nullptr && g_chunks != last) {
+        auto next = g_chunks->next;
+
+        private_stats_heap(-g_chunks->size);
+        private_stats_add(&__g_heap_stats.chunks, -1ULL);
+
+        if (__g_free != nullptr) {
+            __g_free(g_chunks->ptr, g_chunks->size);
+        }
+
+        g_chunks = next;
+    }
+}
+
+// Forgets about all of the free spans, slabs and span_t structures that
+// could be reused.
+
+static void
+private_heap_drop()
+{
+    g_spare_spans = nullptr;
+
+    for (auto &bin : g_bins) {
+        bin = nullptr;
+    }
+
+    for (auto &used : g_bins_used) {
+        used = 0;
+    }
+
+    for (auto &slab : g_slabs) {
+        slab = nullptr;
+    }
+}
+
+extern "C" void
+_heap_init(void) noexcept
+{
+    __g_heap_stats = {};
+
+    g_heap = {};
+    g_chunks = nullptr;
+    g_sealed_chunks = nullptr;
+    g_grow_pages = HEAP_MIN_CHUNK_PAGES;
+    g_deferred = nullptr;
+
+    private_heap_drop();
+
+    for (auto cls = 1ULL; cls < HEAP_NUM_CLASSES; cls++) {
+        g_class_size[cls] = private_class_to_size(cls);
+        g_class_pages[cls] = private_class_pages(g_class_size[cls]);
+    }
+
+    auto cursor = reinterpret_cast<uint64_t>(__g_heap_cursor);
+    auto base = (cursor + HEAP_PAGE_SIZE - 1) & ~(HEAP_PAGE_SIZE - 1);
+    auto end = reinterpret_cast<uint64_t>(__g_heap + __g_heap_size) & ~(HEAP_PAGE_SIZE - 1);
+
+    if (base >= end || private_sbrk(base - cursor) == 0) {
+        return;
+    }
+
+    auto npages = (end - base) >> HEAP_PAGE_SHIFT;
+    auto size = (npages * sizeof(span_t *) + HEAP_PAGE_SIZE - 1) & ~(HEAP_PAGE_SIZE - 1);
+
+    if (auto pagemap = private_sbrk(size); pagemap != 0) {
+        g_heap.base = base;
+        g_heap.end = end;
+        g_heap.pagemap = reinterpret_cast<span_t **>(pagemap);
+
+        memset(g_heap.pagemap, 0, size);
+
+        if (npages > g_grow_pages) {
+            g_grow_pages = npages;
+        }
+    }
+}
+
+extern "C" void
+_heap_fini(void) noexcept
+{
+    if (__g_heap_stats_out != nullptr) {
+        bfheap_stats(__g_heap_stats_out);
+    }
+
+    private_chunks_free(nullptr);
+    private_heap_drop();
+}
+
+extern "C" void
+bfheap_stats(struct heap_stats_t *stats)
+{
+    private_lock();
+
+    *stats = __g_heap_stats;
+
+    for (auto cls = 1ULL; cls < HEAP_NUM_CLASSES; cls++) {
+        stats->class_size[cls] = g_class_size[cls];
+    }
+
+    if (g_heap.pagemap != nullptr) {
+        stats->largest_free_bytes = g_heap.end - private_top(&g_heap);
+    }
+
+    for (auto bin : g_bins) {
+        for (auto span = bin; span != nullptr; span = span->next) {
+            auto size = span->npages << HEAP_PAGE_SHIFT;
+
+            if (size > stats->largest_free_bytes) {
+                stats->largest_free_bytes = size;
+            }
+
+            stats->free_bytes += size;
+        }
+    }
+
+    private_unlock();
+}
+
+// -----------------------------------------------------------------------------
+// Checkpoints
+// -----------------------------------------------------------------------------
+
+// Everything below the sbrk() cursor and every chunk that exists when a
+// checkpoint is taken is sealed: spans that start below a chunk's seal are
+// not freed (see private_free_locked), and free spans are never merged into
+// them. The free spans, slabs and unused span_t structures are saved in the
+// checkpoint, so that everything that is allocated after the checkpoint
+// comes from above the cursor or from a new chunk. Since nothing below the
+// seals changes while the checkpoint is in place, a reset only has to drop
+// what was allocated since, and put the saved state back.
+
+extern "C" void
+bfheap_checkpoint(struct bfheap_checkpoint_t *checkpoint)
+{
+    private_lock();
+
+    checkpoint->cursor = private_top(&g_heap);
+    checkpoint->seal = g_heap.seal;
+    checkpoint->chunks = g_chunks;
+    checkpoint->sealed_chunks = g_sealed_chunks;
+    checkpoint->grow_pages = g_grow_pages;
+    checkpoint->current_bytes = __g_heap_stats.current_bytes;
+    checkpoint->deferred = g_deferred;
+    checkpoint->spare_spans = g_spare_spans;
+
+    for (auto i = 0ULL; i < HEAP_NUM_BINS; i++) {
+        checkpoint->bins[i] = g_bins[i];
+    }
+
+    for (auto i = 0ULL; i < HEAP_NUM_BINS / 64; i++) {
+        checkpoint->bins_used[i] = g_bins_used[i];
+    }
+
+    for (auto i = 0ULL; i < HEAP_NUM_CLASSES; i++) {
+        checkpoint->slabs[i] = g_slabs[i];
+    }
+
+    g_heap.seal = checkpoint->cursor;
+    for (auto chunk = g_chunks; chunk != g_sealed_chunks; chunk = chunk->next) {
+        chunk->seal = chunk->end;
+    }
+
+    g_sealed_chunks = g_chunks;
+    g_deferred = nullptr;
+
+    private_heap_drop();
+    private_unlock();
+}
+
+extern "C" void
+bfheap_reset(const struct bfheap_checkpoint_t *checkpoint)
+{
+    private_lock();
+
+    private_chunks_free(static_cast<chunk_t *>(checkpoint->chunks));
+    g_grow_pages = checkpoint->grow_pages;
+
+    private_sbrk(checkpoint->cursor - private_top(&g_heap));
+    __atomic_store_n(&__g_heap_stats.current_bytes, checkpoint->current_bytes, __ATOMIC_RELAXED);
+
+    g_heap.seal = checkpoint->seal;
+    for (auto chunk = g_chunks; chunk != checkpoint->sealed_chunks; chunk = chunk->next) {
+        chunk->seal = 0;
+    }
+
+    g_sealed_chunks = static_cast<chunk_t *>(checkpoint->sealed_chunks);
+    g_spare_spans = static_cast<span_t *>(checkpoint->spare_spans);
+
+    for (auto i = 0ULL; i < HEAP_NUM_BINS; i++) {
+        g_bins[i] = static_cast<span_t *>(checkpoint->bins[i]);
+    }
+
+    for (auto i = 0ULL; i < HEAP_NUM_BINS / 64; i++) {
+        g_bins_used[i] = checkpoint->bins_used[i];
+    }
+
+    for (auto i = 0ULL; i < HEAP_NUM_CLASSES; i++) {
+        g_slabs[i] = static_cast<span_t *>(checkpoint->slabs[i]);
+    }
+
+    // Memory that was freed while the checkpoint was in place is freed
+    // again, which defers it once more if it is sealed by an older
+    // checkpoint.
+
+    auto deferred = g_deferred;
+    g_deferred = checkpoint->deferred;
+
+    while (deferred != nullptr) {
+        auto next = *static_cast<void **>(deferred);
+
+        private_free_locked(deferred);
+        deferred = next;
+    }
+
+    private_unlock();
+}
+
+//------------------------------------------------------------------------------
+// Libc
+//------------------------------------------------------------------------------
+
+extern "C" WEAK_SYM void *
+malloc(size_t size)
+{ return private_malloc(size); }
+
+extern "C" WEAK_SYM void
+free(void *ptr)
+{
+    if (ptr != nullptr) {
+        private_free(ptr);
+    }
+}
+
+extern "C" WEAK_SYM void *
+calloc(size_t num, size_t size)
+{
+    if (size != 0 && num > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    auto ptr = private_malloc(num * size);
+    if (ptr != nullptr) {
+        memset(ptr, 0, num * size);
+    }
+
+    return ptr;
+}
+
+extern "C" WEAK_SYM void *
+realloc(void *ptr, size_t size)
+{
+    if (ptr == nullptr) {
+        return private_malloc(size);
+    }
+
+    if (size == 0) {
+        private_free(ptr);
+        return nullptr;
+    }
+
+    // A block that shrinks stays where it is, unless it drops below half of
+    // its size, in which case it is moved to a smaller size class (or fewer
+    // pages) so that the rest of it can be reused. If that fails, the old
+    // block is still big enough, so it is returned instead.
+
+    auto old_size = private_usable_size(ptr);
+    if (size <= old_size) {
+        if (size >= old_size / 2 || old_size <= private_class_to_size(1)) {
+            return ptr;
+        }
+
+        auto new_ptr = private_malloc(size);
+        if (new_ptr == nullptr) {
+            return ptr;
+        }
+
+        memcpy(new_ptr, ptr, size);
+        private_free(ptr);
+
+        return new_ptr;
+    }
+
+    auto new_ptr = private_malloc(size);
+    if (new_ptr != nullptr) {
+        memcpy(new_ptr, ptr, old_size);
+        private_free(ptr);
+    }
+
+    return new_ptr;
+}
+
+extern "C" WEAK_SYM size_t
+malloc_usable_size(void *ptr)
+{ return ptr != nullptr ? private_usable_size(ptr) : 0; }
+
+extern "C" WEAK_SYM void *
+memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    return private_memalign(alignment, size);
+}
+
+extern "C" WEAK_SYM void *
+aligned_alloc(size_t alignment, size_t size)
+{ return memalign(alignment, size); }
+
+extern "C" WEAK_SYM int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+
+    if (*memptr = private_memalign(alignment, size); *memptr != nullptr) {
+        return 0;
+    }
+
+    return ENOMEM;
+}
+
+// Newlib calls the reentrant versions of these functions directly (e.g.,
+// from stdio), so they are provided as well. Otherwise newlib's allocator
+// would be linked in and would manage the same heap.
+
+extern "C" WEAK_SYM void *
+_malloc_r(struct _reent *r, size_t size)
+{ bfignored(r); return malloc(size); }
+
+extern "C" WEAK_SYM void
+_free_r(struct _reent *r, void *ptr)
+{ bfignored(r); free(ptr); }
+
+extern "C" WEAK_SYM void *
+_calloc_r(struct _reent *r, size_t num, size_t size)
+{ bfignored(r); return calloc(num, size); }
+
+extern "C" WEAK_SYM void *
+_realloc_r(struct _reent *r, void *ptr, size_t size)
+{ bfignored(r); return realloc(ptr, size); }
+
+extern "C" WEAK_SYM size_t
+_malloc_usable_size_r(struct _reent *r, void *ptr)
+{ bfignored(r); return malloc_usable_size(ptr); }
+
+extern "C" WEAK_SYM void *
+_memalign_r(struct _reent *r, size_t alignment, size_t size)
+{ bfignored(r); return memalign(alignment, size); }
+
+//------------------------------------------------------------------------------
+// C++
+//------------------------------------------------------------------------------
+
+// Like operator new, operator delete uses the allocator directly instead of
+// the (weak) free(), so that if malloc() or free() are replaced, memory that
+// is allocated with new is still given back to the allocator it came from.
+
+static void
+private_delete(void *ptr) noexcept
+{
+    if (ptr != nullptr) {
+        private_free(ptr);
+    }
+}
+
+WEAK_SYM void *
+operator new(std::size_t size)
+{
+    if (auto ptr = private_malloc(size); ptr != nullptr) {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+WEAK_SYM void *
+operator new[](std::size_t size)
+{ return ::operator new(size); }
+
+WEAK_SYM void *
+operator new(std::size_t size, const std::nothrow_t & /*unused*/) noexcept
+{ return private_malloc(size); }
+
+WEAK_SYM void *
+operator new[](std::size_t size, const std::nothrow_t & /*unused*/) noexcept
+{ return private_malloc(size); }
+
+WEAK_SYM void
+operator delete(void *ptr) noexcept
+{ private_delete(ptr); }
+
+WEAK_SYM void
+operator delete[](void *ptr) noexcept
+{ private_delete(ptr); }
+
+WEAK_SYM void
+operator delete(void *ptr, std::size_t /*unused*/) noexcept
+{ private_delete(ptr); }
+
+WEAK_SYM void
+operator delete[](void *ptr, std::size_t /*unused*/) noexcept
+{ private_delete(ptr); }
+
+WEAK_SYM void
+operator delete(void *ptr, const std::nothrow_t & /*unused*/) noexcept
+{ private_delete(ptr); }
+
+WEAK_SYM void
+operator delete[](void *ptr, const std::nothrow_t & /*unused*/) noexcept
+{ private_delete(ptr); }
+
+WEAK_SYM void *
+operator new(std::size_t size, std::align_val_t alignment)
+{
+    if (auto ptr = private_memalign(static_cast<uint64_t>(alignment), size); ptr != nullptr) {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+WEAK_SYM void *
+operator new[](std::size_t size, std::align_val_t alignment)
+{ return ::operator new(size, alignment); }
+
+WEAK_SYM void *
+operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t & /*unused*/) noexcept
+{ return private_memalign(static_cast<uint64_t>(alignment), size); }
+
+WEAK_SYM void *
+operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t & /*unused*/) noexcept
+{ return private_memalign(static_cast<uint64_t>(alignment), size); }
+
+WEAK_SYM void
+operator delete(void *ptr, std::align_val_t /*unused*/) noexcept
+{ private_delete(ptr); }
+
+WEAK_SYM void
+operator delete[](void *ptr, std::align_val_t /*unused*/) noexcept
+{ private_delete(ptr); }
+
+WEAK_SYM void
+operator delete(void *ptr, std::size_t /*unused*/, std::align_val_t /*unused*/) noexcept
+{ private_delete(ptr); }
+
+WEAK_SYM void
+operator delete[](void *ptr, std::size_t /*unused*/, std::align_val_t /*unused*/) noexcept
+{ private_delete(ptr); }
+
+WEAK_SYM void
+operator delete(void *ptr, std::align_val_t /*unused*/, const std::nothrow_t & /*unused*/) noexcept
+{ private_delete(ptr); }
+
+WEAK_SYM void
+operator delete[](void *ptr, std::align_val_t /*unused*/, const std::nothrow_t & /*unused*/) noexcept
+{ private_delete(ptr); }
+
+#else
+
+extern "C" void
+_heap_init(void) noexcept
+{ }
+
+extern "C" void
+_heap_fini(void) noexcept
+{ }
+
+extern "C" void
+bfheap_checkpoint(struct bfheap_checkpoint_t *checkpoint)
+{ memset(checkpoint, 0, sizeof(*checkpoint)); }
+
+extern "C" void
+bfheap_reset(const struct bfheap_checkpoint_t *checkpoint)
+{ bfignored(checkpoint); }
+
+extern "C" void
+bfheap_stats(struct heap_stats_t *stats)
+{ memset(stats, 0, sizeof(*stats)); }
+
+extern "C" WEAK_SYM int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+
+    if (*memptr = memalign(alignment, size); *memptr != nullptr) {
+        return 0;
+    }
+
+    return ENOMEM;
+}
+
+#endif
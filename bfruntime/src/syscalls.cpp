@@ -35,7 +35,6 @@
 //     similar to libc which is needed by all C++ implementations.
 //
 
-#include <new>
 #include <cerrno>
 
 #include <bftypes.h>
@@ -201,24 +200,6 @@ sbrk(ptrdiff_t incr)
     return cursor;
 }
 
-extern "C" WEAK_SYM int
-posix_memalign(void **memptr, size_t alignment, size_t size)
-{
-    bfignored(alignment);
-
-    // TODO:
-    //
-    // Fix this. Once we have our own Libc, we can address this issue with
-    // whatever allocation engine we choose to use.
-    //
-
-    if (*memptr = new (std::nothrow) char[size]; *memptr != nullptr) {
-        return 0;
-    }
-
-    return ENOMEM;
-}
-
 //------------------------------------------------------------------------------
 // TODO
 //------------------------------------------------------------------------------
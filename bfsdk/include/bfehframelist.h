@@ -42,10 +42,24 @@ extern "C" {
  *     the starting address of the the .eh_frame section
  * @var eh_frame_t::size
  *     the size of the .eh_frame section
+ * @var eh_frame_t::hdr_addr
+ *     the starting address of the .eh_frame_hdr section (nullptr if the
+ *     ELF file was not linked with --eh-frame-hdr)
+ * @var eh_frame_t::hdr_size
+ *     the size of the .eh_frame_hdr section
+ * @var eh_frame_t::table_addr
+ *     the starting address of the compact unwind table generated by
+ *     bfcompile (nullptr if there is no table, see bfunwindtable.h)
+ * @var eh_frame_t::table_size
+ *     the size of the compact unwind table
  */
 struct eh_frame_t {
     void *addr;
     uint64_t size;
+    void *hdr_addr;
+    uint64_t hdr_size;
+    void *table_addr;
+    uint64_t table_size;
 };
 
 /**
@@ -36,6 +36,42 @@
 #define BFHEAP_ALLOC_SIZE BFHEAP_SIZE
 #endif
 
+/*
+ * Single Allocation
+ *
+ * If BFSINGLE_ALLOCATION is defined, bfexecs() allocates the TLS block, the
+ * stack and the heap (when none of them are provided) using a single call
+ * to alloc (see alloc_region), and frees them using a single call to free,
+ * instead of calling alloc and free once for each of them. On UEFI, each
+ * call to alloc is a call to AllocatePages.
+ */
+
+#ifdef BFTHREAD_CONTEXT_GS
+#define BFREGION_ALLOC_SIZE (BFHEAP_ALLOC_SIZE + BFTLS_ALLOC_SIZE + BFSTACK_SIZE)
+#else
+#define BFREGION_ALLOC_SIZE (BFHEAP_ALLOC_SIZE + BFTLS_ALLOC_SIZE + (BFSTACK_SIZE * 2))
+#endif
+
+/**
+ * Thread Pointer
+ *
+ * If BFTHREAD_CONTEXT_GS is defined, bfexecs() points the GS base at the
+ * application's thread context before it starts the application, and
+ * restores the GS base it had before once the application returns. The GS
+ * base is read and written using funcs->get_thread_pointer and
+ * funcs->set_thread_pointer. If these are not provided, rdgsbase and
+ * wrgsbase are used instead, but only if BFTHREAD_CONTEXT_FSGSBASE is
+ * defined, which tells bfexec that CR4.FSGSBASE is known to be set (these
+ * instructions raise #UD otherwise). If it is not defined, bfexecs() fails.
+ *
+ * Note that the application's GS base is still loaded while the
+ * application is running, which includes any calls it makes to
+ * funcs->syscall, alloc and free. If the host relies on its own GS base
+ * (e.g., per-CPU data in ring 0), these functions must switch to the host's
+ * GS base themselves, and switch back to the application's before they
+ * return.
+ */
+
 /**
  * Platform Functions
  *
@@ -47,6 +83,42 @@
  *     a pointer to an the mark_rx function used by bfexec
  * @var bfexec_funcs_t::syscall (optional)
  *     a pointer to an the syscall function used by bfexec
+ * @var bfexec_funcs_t::alloc_zeroed (optional)
+ *     set to 1 if the alloc function always returns zeroed memory (e.g.,
+ *     mmap), in which case the ELF loader does not zero the executable
+ * @var bfexec_funcs_t::map_file (optional)
+ *     a pointer to a function that maps part of the ELF file into the
+ *     executable (see bfelf_file_t::map_file), in which case RX segments are
+ *     executed from the file's pages instead of being copied
+ * @var bfexec_funcs_t::map_shared (optional)
+ *     a pointer to a function that maps the pages at "src" (which were
+ *     returned by alloc) a second time at "dst", replacing the pages at
+ *     "dst", so that both addresses share the same memory. Both addresses
+ *     and the size are page aligned. This is required by
+ *     bfexec_instance_create().
+ * @var bfexec_funcs_t::parallel_for (optional)
+ *     a pointer to a function that runs func(ctx, i) for every i in
+ *     [0, num), possibly in parallel (see bfelf_file_t::parallel_for), in
+ *     which case the ELF loader copies and relocates large images using
+ *     more than one thread
+ * @var bfexec_funcs_t::set_thread_pointer (optional)
+ *     a pointer to a function that sets the GS base of the current thread
+ *     to "ptr" when BFTHREAD_CONTEXT_GS is defined (e.g., arch_prctl on
+ *     Linux, or a write to IA32_GS_BASE in ring 0). If this is provided,
+ *     get_thread_pointer must be provided as well. If neither is provided,
+ *     rdgsbase/wrgsbase are used, which is only allowed if
+ *     BFTHREAD_CONTEXT_FSGSBASE is defined (see Thread Pointer).
+ * @var bfexec_funcs_t::get_thread_pointer (optional)
+ *     a pointer to a function that returns the GS base of the current
+ *     thread (e.g., arch_prctl with ARCH_GET_GS on Linux, or a read of
+ *     IA32_GS_BASE in ring 0), which is used to restore the GS base once the
+ *     application returns. Required if set_thread_pointer is provided.
+ * @var bfexec_funcs_t::heap_reset (optional)
+ *     set to 1 to have bfexec_run() and bfexec_instance_run() resume the
+ *     application after its first run instead of restoring its RW segments
+ *     and starting it from scratch, with its heap reset to the state it was
+ *     in after static initialization (see _start_args_t::heap_reset). This
+ *     is ignored if BFINCLUDE_ALLOCATIONS is defined.
  */
 struct bfexec_funcs_t
 {
@@ -54,6 +126,13 @@ struct bfexec_funcs_t
     void (*free)(void *ptr, size_t size);
     status_t (*mark_rx)(void *ptr, size_t size);
     void (*syscall)(uint64_t id, void *args);
+    uint8_t alloc_zeroed;
+    status_t (*map_file)(void *addr, bfelf64_off offset, bfelf64_xword size);
+    status_t (*map_shared)(void *dst, void *src, size_t size);
+    void (*parallel_for)(void (*func)(void *, bfelf64_xword), void *ctx, bfelf64_xword num);
+    void (*set_thread_pointer)(uint64_t ptr);
+    uint64_t (*get_thread_pointer)(void);
+    uint8_t heap_reset;
 };
 
 /**
@@ -65,7 +144,6 @@ struct bfexec_funcs_t
 static inline void *
 alloc_tls(void *(*alloc)(size_t size))
 {
-    size_t i;
     void *ptr = alloc(BFTLS_ALLOC_SIZE);
 
     if (ptr == nullptr) {
@@ -73,9 +151,7 @@ alloc_tls(void *(*alloc)(size_t size))
         return nullptr;
     }
 
-    for (i = 0; i < BFTLS_ALLOC_SIZE; i++) {
-        BFSCAST(char*, ptr)[i] = 0;
-    }
+    private_memset(ptr, 0, BFTLS_ALLOC_SIZE);
 
     return ptr;
 }
@@ -118,6 +194,62 @@ alloc_heap(void *(*alloc)(size_t size))
     return ptr;
 }
 
+/**
+ * Alloc Region
+ *
+ * Allocates a single region of BFREGION_ALLOC_SIZE bytes, and carves the
+ * TLS block, the stack and the heap out of it. The stack is placed so that
+ * its top is aligned to BFSTACK_SIZE (as setup_stack() requires), with the
+ * TLS block above it, and everything below the stack is the heap. Unlike
+ * alloc_stack(), which allocates twice the size of the stack so that an
+ * aligned stack fits, the memory that is skipped to align the stack is not
+ * wasted here, but is given to the heap, so the heap is always at least
+ * BFHEAP_ALLOC_SIZE bytes. If BFTHREAD_CONTEXT_GS is defined, the stack does
+ * not need to be aligned, and it is placed directly below the TLS block.
+ *
+ * The stack that is returned is the pointer that setup_stack() and
+ * validate_canaries() expect (i.e., BFSTACK_SIZE below the bottom of the
+ * stack), and not the start of an allocation, so it must not be freed.
+ * Instead, the region that is returned is freed using BFREGION_ALLOC_SIZE.
+ *
+ * @param alloc a function pointer to an alloc function
+ * @param _start_args the start args whose tls, stack, heap and heap_size
+ *     fields are filled in
+ * @return a pointer to the newly allocated region
+ */
+static inline void *
+alloc_region(void *(*alloc)(size_t size), struct _start_args_t *_start_args)
+{
+    uint64_t base;
+    uint64_t bos;
+    void *ptr = alloc(BFREGION_ALLOC_SIZE);
+
+    if (ptr == nullptr) {
+        BFALERT("alloc_region failed to allocate the TLS block, stack and heap\n");
+        return nullptr;
+    }
+
+    base = BFRCAST(uint64_t, ptr);
+
+#ifdef BFTHREAD_CONTEXT_GS
+    bos = base + BFREGION_ALLOC_SIZE - BFTLS_ALLOC_SIZE - BFSTACK_SIZE;
+
+    _start_args->tls = BFRCAST(void *, bos + BFSTACK_SIZE);
+    _start_args->stack = BFRCAST(void *, bos);
+#else
+    bos = (base + BFREGION_ALLOC_SIZE - BFTLS_ALLOC_SIZE - BFSTACK_SIZE) & ~(BFSTACK_SIZE - 1);
+
+    _start_args->tls = BFRCAST(void *, bos + BFSTACK_SIZE);
+    _start_args->stack = BFRCAST(void *, bos - BFSTACK_SIZE);
+#endif
+    _start_args->heap = ptr;
+    _start_args->heap_size = bos - base;
+
+    private_memset(_start_args->tls, 0, BFTLS_ALLOC_SIZE);
+
+    return ptr;
+}
+
 /**
  * Bareflank Execute
  *
@@ -145,9 +277,13 @@ alloc_heap(void *(*alloc)(size_t size))
 static inline status_t
 bfexecs(struct bfelf_file_t *ef, struct _start_args_t *_start_args)
 {
-    status_t ret;
+    status_t ret = BFFAILURE;
     uint64_t sp = 0;
 
+#ifdef BFTHREAD_CONTEXT_GS
+    uint64_t gs = 0;
+#endif
+
 #ifdef BFINCLUDE_ALLOCATIONS
     static char s_tls[BFTLS_ALLOC_SIZE] = {0};
     static char s_stack[BFSTACK_ALLOC_SIZE];
@@ -166,6 +302,10 @@ bfexecs(struct bfelf_file_t *ef, struct _start_args_t *_start_args)
     void *heap = _start_args->heap;
 #endif
 
+#ifdef BFSINGLE_ALLOCATION
+    void *region = nullptr;
+#endif
+
     if (ef == nullptr) {
         BFALERT("bfexec failed: invalid ELF file\n");
         return BFFAILURE;
@@ -176,7 +316,13 @@ bfexecs(struct bfelf_file_t *ef, struct _start_args_t *_start_args)
         return BFFAILURE;
     }
 
-    if (ef->relocated == 0) {
+    /*
+     * If the ELF file was already relocated (e.g., bfcompile was given a
+     * base address) and exec is where it was relocated for, it is run as
+     * is. If exec is somewhere else, bfelf_file_relocate() moves it.
+     */
+
+    if (ef->relocated == 0 || (_start_args->exec != nullptr && ef->base != BFRCAST(bfelf64_addr, _start_args->exec))) {
         if (_start_args->exec == nullptr) {
             BFALERT("bfexec failed: exec must be set if ELF is not relocated\n");
             return BFFAILURE;
@@ -196,6 +342,16 @@ bfexecs(struct bfelf_file_t *ef, struct _start_args_t *_start_args)
         }
     }
 
+#ifdef BFSINGLE_ALLOCATION
+    if (tls == nullptr && stack == nullptr && heap == nullptr) {
+        region = alloc_region(_start_args->alloc, _start_args);
+        if (region == nullptr) {
+            BFALERT("bfexec failed: failed to allocate the tls block, stack and heap\n");
+            return BFFAILURE;
+        }
+    }
+#endif
+
     if (_start_args->tls == nullptr) {
         _start_args->tls = alloc_tls(_start_args->alloc);
         if (_start_args->tls == nullptr) {
@@ -226,6 +382,10 @@ bfexecs(struct bfelf_file_t *ef, struct _start_args_t *_start_args)
 
     _start_args->eh_frame_addr = ef->eh_frame_addr;
     _start_args->eh_frame_size = ef->eh_frame_size;
+    _start_args->eh_frame_hdr_addr = ef->eh_frame_hdr_addr;
+    _start_args->eh_frame_hdr_size = ef->eh_frame_hdr_size;
+    _start_args->unwind_table_addr = ef->unwind_table_addr;
+    _start_args->unwind_table_size = ef->unwind_table_size;
     _start_args->init_array_addr = ef->init_array_addr;
     _start_args->init_array_size = ef->init_array_size;
     _start_args->fini_array_addr = ef->fini_array_addr;
@@ -235,8 +395,40 @@ bfexecs(struct bfelf_file_t *ef, struct _start_args_t *_start_args)
         _start_args->stack, _start_args->thread_id, _start_args->tls
     );
 
+#ifdef BFTHREAD_CONTEXT_GS
+    if (_start_args->set_thread_pointer != nullptr) {
+        if (_start_args->get_thread_pointer == nullptr) {
+            BFALERT("bfexec failed: get_thread_pointer must be set if set_thread_pointer is set\n");
+            goto release;
+        }
+
+        gs = _start_args->get_thread_pointer();
+        _start_args->set_thread_pointer(sp);
+    }
+    else {
+#ifdef BFTHREAD_CONTEXT_FSGSBASE
+        __asm__ volatile("rdgsbase %0" : "=r"(gs) :: "memory");
+        __asm__ volatile("wrgsbase %0" :: "r"(sp) : "memory");
+#else
+        BFALERT("bfexec failed: set_thread_pointer must be set if BFTHREAD_CONTEXT_FSGSBASE is not defined\n");
+        goto release;
+#endif
+    }
+#endif
+
     ret = ((_start_t)ef->entry)(sp, _start_args);
 
+#ifdef BFTHREAD_CONTEXT_GS
+    if (_start_args->set_thread_pointer != nullptr) {
+        _start_args->set_thread_pointer(gs);
+    }
+#ifdef BFTHREAD_CONTEXT_FSGSBASE
+    else {
+        __asm__ volatile("wrgsbase %0" :: "r"(gs) : "memory");
+    }
+#endif
+#endif
+
     if (validate_canaries(_start_args->stack) != BFSUCCESS) {
         BFALERT("stack corruption detected!!!\n");
         return BFFAILURE;
@@ -244,6 +436,16 @@ bfexecs(struct bfelf_file_t *ef, struct _start_args_t *_start_args)
 
 release:
 
+#ifdef BFSINGLE_ALLOCATION
+    if (region != nullptr) {
+        if (_start_args->free != nullptr) {
+            _start_args->free(region, BFREGION_ALLOC_SIZE);
+        }
+
+        return ret;
+    }
+#endif
+
     if (_start_args->free != nullptr && tls == nullptr) {
         _start_args->free(_start_args->tls, BFTLS_ALLOC_SIZE);
     }
@@ -259,6 +461,82 @@ release:
     return ret;
 }
 
+/**
+ * @cond
+ */
+
+static inline status_t
+private_bfexecv(
+    struct bfelf_file_t *ef,
+    int argc,
+    const char **argv,
+    struct bfexec_funcs_t *funcs)
+{
+    status_t ret = BFFAILURE;
+
+    void *exec;
+    struct _start_args_t _start_args = {0};
+
+    exec = funcs->alloc(ef->size);
+    if (exec == nullptr) {
+        BFALERT("bfexec failed: failed to allocate memory for exec\n");
+        return BFFAILURE;
+    }
+
+    ef->exec_zeroed = funcs->alloc_zeroed;
+    ef->map_file = funcs->map_file;
+    ef->parallel_for = funcs->parallel_for;
+
+    if (bfelf_file_load(ef, exec, funcs->mark_rx) != BFSUCCESS) {
+        BFALERT("bfexec failed: failed to load ELF file\n");
+        goto release;
+    }
+
+    if (bfelf_file_relocate(ef, 0) != BFSUCCESS) {
+        BFALERT("bfexec failed: failed to relocate ELF file\n");
+        goto release;
+    }
+
+    _start_args.argc = argc;
+    _start_args.argv = argv;
+    _start_args.alloc = funcs->alloc;
+    _start_args.free = funcs->free;
+    _start_args.syscall = funcs->syscall;
+    _start_args.set_thread_pointer = funcs->set_thread_pointer;
+    _start_args.get_thread_pointer = funcs->get_thread_pointer;
+
+    ret = bfexecs(ef, &_start_args);
+
+release:
+
+    if (funcs->free != nullptr) {
+        funcs->free(exec, ef->size);
+    }
+
+    return ret;
+}
+
+static inline status_t
+private_bfexec_check_funcs(
+    struct bfexec_funcs_t *funcs)
+{
+    if (funcs == nullptr) {
+        BFALERT("bfexec failed: invalid funcs pointer\n");
+        return BFFAILURE;
+    }
+
+    if (funcs->alloc == nullptr) {
+        BFALERT("bfexec failed: invalid funcs->alloc pointer\n");
+        return BFFAILURE;
+    }
+
+    return BFSUCCESS;
+}
+
+/**
+ * @endcond
+ */
+
 /**
  * Bareflank Execute (With Argc/Argv)
  *
@@ -296,24 +574,14 @@ bfexecv(
     const char **argv,
     struct bfexec_funcs_t *funcs)
 {
-    status_t ret;
-
-    void *exec;
     struct bfelf_file_t ef;
-    struct _start_args_t _start_args = {0};
 
     if (file == nullptr) {
         BFALERT("bfexec failed: invalid ELF file\n");
         return BFFAILURE;
     }
 
-    if (funcs == nullptr) {
-        BFALERT("bfexec failed: invalid funcs pointer\n");
-        return BFFAILURE;
-    }
-
-    if (funcs->alloc == nullptr) {
-        BFALERT("bfexec failed: invalid funcs->alloc pointer\n");
+    if (private_bfexec_check_funcs(funcs) != BFSUCCESS) {
         return BFFAILURE;
     }
 
@@ -322,37 +590,50 @@ bfexecv(
         return BFFAILURE;
     }
 
-    exec = funcs->alloc(ef.size);
-    if (exec == nullptr) {
-        BFALERT("bfexec failed: failed to allocate memory for exec\n");
-        return BFFAILURE;
-    }
+    return private_bfexecv(&ef, argc, argv, funcs);
+}
 
-    if (bfelf_file_load(&ef, exec, funcs->mark_rx) != BFSUCCESS) {
-        BFALERT("bfexec failed: failed to load ELF file\n");
-        goto release;
-    }
+/**
+ * Bareflank Execute (Streaming, With Argc/Argv)
+ *
+ * This version of the bfexec function is the same as bfexecv(), except that
+ * instead of a pointer to the ELF file, it takes a function that is used to
+ * read the ELF file (see bfelf_file_init_stream). The ELF file is read
+ * directly into the memory it will be executed from, which means that the
+ * ELF file does not need to be read into a temporary buffer first. This
+ * removes an extra copy of the ELF file, which is useful when the ELF file
+ * is large, or when memory is limited (e.g., in UEFI).
+ *
+ * @param read_func the function used to read the ELF file
+ * @param argc the number of arguments to pass to ELF file on start
+ * @param argv the arguments to pass to the ELF file on start
+ * @param funcs helper functions needed by bfexec and friends
+ * @return BFSUCCESS on success, BFFAILURE otherwise
+ */
+static inline status_t
+bfexecv_stream(
+    status_t (*read_func)(bfelf64_off, void *, bfelf64_xword),
+    int argc,
+    const char **argv,
+    struct bfexec_funcs_t *funcs)
+{
+    struct bfelf_file_t ef;
 
-    if (bfelf_file_relocate(&ef, 0) != BFSUCCESS) {
-        BFALERT("bfexec failed: failed to relocate ELF file\n");
-        goto release;
+    if (read_func == nullptr) {
+        BFALERT("bfexec failed: invalid read function\n");
+        return BFFAILURE;
     }
 
-    _start_args.argc = argc;
-    _start_args.argv = argv;
-    _start_args.alloc = funcs->alloc;
-    _start_args.free = funcs->free;
-    _start_args.syscall = funcs->syscall;
-
-    ret = bfexecs(&ef, &_start_args);
-
-release:
+    if (private_bfexec_check_funcs(funcs) != BFSUCCESS) {
+        return BFFAILURE;
+    }
 
-    if (funcs->free != nullptr) {
-        funcs->free(exec, ef.size);
+    if (bfelf_file_init_stream(read_func, &ef) != BFSUCCESS) {
+        BFALERT("bfexec failed: failed to init ELF file\n");
+        return BFFAILURE;
     }
 
-    return ret;
+    return private_bfexecv(&ef, argc, argv, funcs);
 }
 
 /**
@@ -389,4 +670,590 @@ bfexec(
     struct bfexec_funcs_t *funcs)
 { return bfexecv(file, 0, nullptr, funcs); }
 
+/**
+ * @struct bfexec_image_t
+ *
+ * A loaded and relocated ELF file that can be executed more than once (see
+ * bfexec_prepare). All of the fields in this structure are private and
+ * should not be used directly.
+ */
+struct bfexec_image_t {
+    struct bfelf_file_t ef;
+    struct bfexec_funcs_t funcs;
+
+    void *exec;
+    void *snapshot;
+
+    void *tls;
+    void *stack;
+    void *heap;
+
+    uint8_t started;
+};
+
+/**
+ * Bareflank Execute Release
+ *
+ * Frees an image that was returned by bfexec_prepare(). If funcs->free was
+ * not provided, this function does nothing.
+ *
+ * @param image the image to release (can be nullptr)
+ */
+static inline void
+bfexec_release(struct bfexec_image_t *image)
+{
+    void (*free_func)(void *ptr, size_t size);
+
+    if (image == nullptr || image->funcs.free == nullptr) {
+        return;
+    }
+
+    free_func = image->funcs.free;
+
+    if (image->heap != nullptr) {
+        free_func(image->heap, BFHEAP_ALLOC_SIZE);
+    }
+
+    if (image->stack != nullptr) {
+        free_func(image->stack, BFSTACK_ALLOC_SIZE);
+    }
+
+    if (image->tls != nullptr) {
+        free_func(image->tls, BFTLS_ALLOC_SIZE);
+    }
+
+    if (image->snapshot != nullptr) {
+        free_func(image->snapshot, image->ef.rw_filesz);
+    }
+
+    if (image->exec != nullptr) {
+        free_func(image->exec, image->ef.size);
+    }
+
+    free_func(image, sizeof(struct bfexec_image_t));
+}
+
+/**
+ * Bareflank Execute Prepare
+ *
+ * bfexecv() loads, relocates, executes and then frees the ELF file every
+ * time it is called. If the same ELF file is executed over and over, most of
+ * this work is the same every time. This function does all of it once, and
+ * returns an image that can then be executed as many times as needed using
+ * bfexec_run(), and finally freed using bfexec_release().
+ *
+ * Once the ELF file is relocated, a copy of the file portion of its RW
+ * segments (i.e., .data, .init_array, the GOT, etc...) is made. Before each
+ * run, this copy is used to restore the RW segments and the BSS is zeroed,
+ * so that each run starts with the same global state as a fresh bfexecv().
+ * The TLS block, stack and heap are allocated once and reused.
+ *
+ * Note that an image can only be executed by one thread at a time.
+ *
+ * @param file a pointer to the ELF file to load. This buffer is not
+ *     needed once this function returns.
+ * @param funcs helper functions needed by bfexec and friends. These are
+ *     copied into the image.
+ * @return a pointer to the image on success, nullptr otherwise
+ */
+static inline struct bfexec_image_t *
+bfexec_prepare(
+    void *file,
+    struct bfexec_funcs_t *funcs)
+{
+    struct bfexec_image_t *image;
+
+    if (file == nullptr) {
+        BFALERT("bfexec_prepare failed: invalid ELF file\n");
+        return nullptr;
+    }
+
+    if (private_bfexec_check_funcs(funcs) != BFSUCCESS) {
+        return nullptr;
+    }
+
+    image = BFSCAST(struct bfexec_image_t *, funcs->alloc(sizeof(struct bfexec_image_t)));
+    if (image == nullptr) {
+        BFALERT("bfexec_prepare failed: failed to allocate the image\n");
+        return nullptr;
+    }
+
+    private_memset(image, 0, sizeof(struct bfexec_image_t));
+    image->funcs = *funcs;
+
+    if (bfelf_file_init(file, &image->ef) != BFSUCCESS) {
+        BFALERT("bfexec_prepare failed: failed to init ELF file\n");
+        goto failure;
+    }
+
+    image->exec = funcs->alloc(image->ef.size);
+    if (image->exec == nullptr) {
+        BFALERT("bfexec_prepare failed: failed to allocate memory for exec\n");
+        goto failure;
+    }
+
+    image->ef.exec_zeroed = funcs->alloc_zeroed;
+    image->ef.map_file = funcs->map_file;
+    image->ef.parallel_for = funcs->parallel_for;
+
+    if (bfelf_file_load(&image->ef, image->exec, funcs->mark_rx) != BFSUCCESS) {
+        BFALERT("bfexec_prepare failed: failed to load ELF file\n");
+        goto failure;
+    }
+
+    if (bfelf_file_relocate(&image->ef, 0) != BFSUCCESS) {
+        BFALERT("bfexec_prepare failed: failed to relocate ELF file\n");
+        goto failure;
+    }
+
+    if (image->ef.rw_filesz != 0) {
+        image->snapshot = funcs->alloc(image->ef.rw_filesz);
+        if (image->snapshot == nullptr) {
+            BFALERT("bfexec_prepare failed: failed to allocate the snapshot\n");
+            goto failure;
+        }
+
+        private_memcpy(
+            image->snapshot, image->ef.exec + image->ef.rw_offset, image->ef.rw_filesz);
+    }
+
+#ifndef BFINCLUDE_ALLOCATIONS
+    image->tls = alloc_tls(funcs->alloc);
+    if (image->tls == nullptr) {
+        goto failure;
+    }
+
+    image->stack = alloc_stack(funcs->alloc);
+    if (image->stack == nullptr) {
+        goto failure;
+    }
+
+    image->heap = alloc_heap(funcs->alloc);
+    if (image->heap == nullptr) {
+        goto failure;
+    }
+#endif
+
+    return image;
+
+failure:
+
+    bfexec_release(image);
+    return nullptr;
+}
+
+/**
+ * Bareflank Execute Run
+ *
+ * Executes an image that was returned by bfexec_prepare(). The RW segments
+ * of the image are restored to the state they were in after relocation, the
+ * BSS and TLS block are zeroed, and then the application is started with
+ * the provided argc/argv. If funcs->heap_reset was set, this is only done
+ * for the first run, and every run after that resumes the application.
+ *
+ * @param image the image to execute
+ * @param argc the number of arguments to pass to ELF file on start
+ * @param argv the arguments to pass to the ELF file on start
+ * @return the application's return value on success, BFFAILURE otherwise
+ */
+static inline status_t
+bfexec_run(
+    struct bfexec_image_t *image,
+    int argc,
+    const char **argv)
+{
+    struct _start_args_t _start_args = {0};
+
+    if (image == nullptr) {
+        BFALERT("bfexec_run failed: invalid image\n");
+        return BFFAILURE;
+    }
+
+    if (image->funcs.heap_reset != 0 && image->heap != nullptr) {
+        _start_args.heap_reset = 1;
+    }
+
+    if (_start_args.heap_reset == 0 || image->started == 0) {
+        if (image->snapshot != nullptr) {
+            private_memcpy(
+                image->ef.exec + image->ef.rw_offset, image->snapshot, image->ef.rw_filesz);
+        }
+
+        private_memset(
+            image->ef.exec + image->ef.rw_offset + image->ef.rw_filesz, 0,
+            image->ef.rw_memsz - image->ef.rw_filesz);
+
+        if (image->tls != nullptr) {
+            private_memset(image->tls, 0, BFTLS_ALLOC_SIZE);
+        }
+
+        image->started = BFSCAST(uint8_t, _start_args.heap_reset);
+    }
+
+    _start_args.argc = argc;
+    _start_args.argv = argv;
+    _start_args.exec = image->exec;
+    _start_args.tls = image->tls;
+    _start_args.stack = image->stack;
+    _start_args.heap = image->heap;
+    _start_args.alloc = image->funcs.alloc;
+    _start_args.free = image->funcs.free;
+    _start_args.syscall = image->funcs.syscall;
+    _start_args.set_thread_pointer = image->funcs.set_thread_pointer;
+    _start_args.get_thread_pointer = image->funcs.get_thread_pointer;
+
+    return bfexecs(&image->ef, &_start_args);
+}
+
+/**
+ * @struct bfexec_instance_t
+ *
+ * An instance of an image that shares the image's read-only pages (see
+ * bfexec_instance_create). All of the fields in this structure are private
+ * and should not be used directly.
+ */
+struct bfexec_instance_t {
+    struct bfelf_file_t ef;
+    struct bfexec_image_t *image;
+
+    void *exec;
+    size_t shared_size;
+
+    void *tls;
+    void *stack;
+    void *heap;
+
+    uint8_t started;
+};
+
+/**
+ * @cond
+ */
+
+/*
+ * Restores the RW segments of an instance from the image's snapshot and
+ * then relocates them. The image's snapshot is relocated for the image's
+ * address, so bfelf_file_relocate() moves it to the instance's address,
+ * which gives the same result as relocating a freshly loaded copy.
+ */
+static inline status_t
+private_bfexec_instance_reset(struct bfexec_instance_t *instance)
+{
+    struct bfexec_image_t *image = instance->image;
+    uint8_t *exec = BFSCAST(uint8_t *, instance->exec);
+
+    if (image->snapshot != nullptr) {
+        private_memcpy(exec + image->ef.rw_offset, image->snapshot, image->ef.rw_filesz);
+    }
+
+    private_memset(
+        exec + image->ef.rw_offset + image->ef.rw_filesz, 0,
+        image->ef.rw_memsz - image->ef.rw_filesz);
+
+    instance->ef = image->ef;
+    instance->ef.exec = exec;
+
+    return bfelf_file_relocate(&instance->ef, 0);
+}
+
+/*
+ * Sharing is only possible if every relocation is in the RW segments, as
+ * the shared pages cannot be relocated differently for each instance.
+ */
+static inline status_t
+private_bfexec_check_in_rw(struct bfelf_file_t *ef, bfelf64_addr offset)
+{
+    if (offset < ef->rw_offset || offset >= ef->rw_offset + ef->rw_filesz) {
+        BFALERT("bfexec_instance_create failed: ELF file has relocations outside of its RW segments\n");
+        return BFFAILURE;
+    }
+
+    return BFSUCCESS;
+}
+
+static inline status_t
+private_bfexec_check_shareable(struct bfexec_image_t *image)
+{
+    bfelf64_xword i;
+    bfelf64_addr where = 0;
+    struct bfelf_file_t *ef = &image->ef;
+
+    if (ef->rw_memsz == 0) {
+        BFALERT("bfexec_instance_create failed: ELF file has no RW segments\n");
+        return BFFAILURE;
+    }
+
+    for (i = 0; i < ef->rela_array_size / sizeof(struct bfelf_rela); i++) {
+        if (private_bfexec_check_in_rw(ef, private_relatab(ef)[i].r_offset) != BFSUCCESS) {
+            return BFFAILURE;
+        }
+    }
+
+    /*
+     * For a RELR bitmap, only the last relocation needs to be checked, as
+     * all of the others are between it and the start of the run.
+     */
+
+    for (i = 0; i < ef->relr_array_size / sizeof(bfelf_relr); i++) {
+        bfelf_relr entry = private_relrtab(ef)[i];
+        bfelf64_addr last = where;
+
+        if ((entry & 1) == 0) {
+            last = entry;
+            where = entry + sizeof(bfelf64_addr);
+        }
+        else {
+            for (entry >>= 2; entry != 0; entry >>= 1) {
+                last += sizeof(bfelf64_addr);
+            }
+
+            where += BFELF_RELR_BITS * sizeof(bfelf64_addr);
+        }
+
+        if (private_bfexec_check_in_rw(ef, last) != BFSUCCESS) {
+            return BFFAILURE;
+        }
+    }
+
+    return BFSUCCESS;
+}
+
+/**
+ * @endcond
+ */
+
+/**
+ * Bareflank Execute Instance Release
+ *
+ * Frees an instance that was returned by bfexec_instance_create(). The image
+ * the instance was created from is not released.
+ *
+ * @param instance the instance to release (can be nullptr)
+ */
+static inline void
+bfexec_instance_release(struct bfexec_instance_t *instance)
+{
+    void (*free_func)(void *ptr, size_t size);
+
+    if (instance == nullptr || instance->image->funcs.free == nullptr) {
+        return;
+    }
+
+    free_func = instance->image->funcs.free;
+
+    if (instance->heap != nullptr) {
+        free_func(instance->heap, BFHEAP_ALLOC_SIZE);
+    }
+
+    if (instance->stack != nullptr) {
+        free_func(instance->stack, BFSTACK_ALLOC_SIZE);
+    }
+
+    if (instance->tls != nullptr) {
+        free_func(instance->tls, BFTLS_ALLOC_SIZE);
+    }
+
+    if (instance->exec != nullptr) {
+        free_func(instance->exec, instance->image->ef.size);
+    }
+
+    free_func(instance, sizeof(struct bfexec_instance_t));
+}
+
+/**
+ * Bareflank Execute Instance Create
+ *
+ * Creates a new instance of an image that was returned by bfexec_prepare().
+ * Each instance has its own copy of the image's address space, but only
+ * the pages that contain the RW segments (and whatever follows them) are
+ * private to the instance. All of the pages before the RW segments (i.e.,
+ * the RX and read-only segments) are mapped from the image using
+ * funcs->map_shared, so they are only in memory once no matter how many
+ * instances there are. Since the layout of each instance is the same as the
+ * image, RIP-relative addressing works as usual. Each instance also gets its
+ * own TLS block, stack and heap, so the memory used by an instance depends
+ * on the size of the application's data and not the size of its code.
+ *
+ * This requires:
+ * - funcs->map_shared, and memory returned by funcs->alloc that can be
+ *   shared (e.g., mmap with MAP_SHARED | MAP_ANONYMOUS on Linux).
+ * - page aligned memory from funcs->alloc.
+ * - the ELF file's RW segments must follow its RX segments, and all of its
+ *   relocations must be in the RW segments (this is how ld lays out a
+ *   static PIE).
+ *
+ * Each instance can be executed by a different thread at the same time, but
+ * a single instance can only be executed by one thread at a time. The image
+ * must not be released until all of its instances have been released.
+ *
+ * Instances are not supported if BFINCLUDE_ALLOCATIONS is defined, as
+ * bfexecs() would run every instance on the same static TLS block, stack
+ * and heap, so this function always fails in that case.
+ *
+ * @param image the image to create an instance of
+ * @return a pointer to the instance on success, nullptr otherwise
+ */
+#ifdef BFINCLUDE_ALLOCATIONS
+static inline struct bfexec_instance_t *
+bfexec_instance_create(struct bfexec_image_t *image)
+{
+    if (image == nullptr) {
+        BFALERT("bfexec_instance_create failed: invalid image\n");
+        return nullptr;
+    }
+
+    BFALERT("bfexec_instance_create failed: not supported with BFINCLUDE_ALLOCATIONS\n");
+    return nullptr;
+}
+#else
+static inline struct bfexec_instance_t *
+bfexec_instance_create(struct bfexec_image_t *image)
+{
+    size_t rw_end;
+    uint8_t *exec;
+    struct bfexec_funcs_t *funcs;
+    struct bfexec_instance_t *instance;
+
+    if (image == nullptr) {
+        BFALERT("bfexec_instance_create failed: invalid image\n");
+        return nullptr;
+    }
+
+    funcs = &image->funcs;
+
+    if (funcs->map_shared == nullptr) {
+        BFALERT("bfexec_instance_create failed: invalid funcs->map_shared pointer\n");
+        return nullptr;
+    }
+
+    if (private_bfexec_check_shareable(image) != BFSUCCESS) {
+        return nullptr;
+    }
+
+    instance = BFSCAST(struct bfexec_instance_t *, funcs->alloc(sizeof(struct bfexec_instance_t)));
+    if (instance == nullptr) {
+        BFALERT("bfexec_instance_create failed: failed to allocate the instance\n");
+        return nullptr;
+    }
+
+    private_memset(instance, 0, sizeof(struct bfexec_instance_t));
+    instance->image = image;
+    instance->shared_size = image->ef.rw_offset & ~(BFSCAST(size_t, BFELF_PAGE_SIZE) - 1);
+
+    instance->exec = funcs->alloc(image->ef.size);
+    if (instance->exec == nullptr) {
+        BFALERT("bfexec_instance_create failed: failed to allocate memory for exec\n");
+        goto failure;
+    }
+
+    exec = BFSCAST(uint8_t *, instance->exec);
+
+    if (((BFRCAST(bfelf64_addr, exec) | BFRCAST(bfelf64_addr, image->exec)) & (BFELF_PAGE_SIZE - 1)) != 0) {
+        BFALERT("bfexec_instance_create failed: exec is not page aligned\n");
+        goto failure;
+    }
+
+    if (instance->shared_size != 0) {
+        if (funcs->map_shared(exec, image->exec, instance->shared_size) != BFSUCCESS) {
+            BFALERT("bfexec_instance_create failed: failed to share the image\n");
+            goto failure;
+        }
+    }
+
+    /*
+     * Everything in the instance's private pages other than the RW segments
+     * does not change once the image is loaded, so it only has to be copied
+     * once. The RW segments are restored before every run.
+     */
+
+    rw_end = image->ef.rw_offset + image->ef.rw_memsz;
+
+    private_memcpy(
+        exec + instance->shared_size, image->ef.exec + instance->shared_size,
+        image->ef.rw_offset - instance->shared_size);
+
+    private_memcpy(exec + rw_end, image->ef.exec + rw_end, image->ef.size - rw_end);
+
+    instance->tls = alloc_tls(funcs->alloc);
+    if (instance->tls == nullptr) {
+        goto failure;
+    }
+
+    instance->stack = alloc_stack(funcs->alloc);
+    if (instance->stack == nullptr) {
+        goto failure;
+    }
+
+    instance->heap = alloc_heap(funcs->alloc);
+    if (instance->heap == nullptr) {
+        goto failure;
+    }
+
+    return instance;
+
+failure:
+
+    bfexec_instance_release(instance);
+    return nullptr;
+}
+#endif
+
+/**
+ * Bareflank Execute Instance Run
+ *
+ * Executes an instance that was returned by bfexec_instance_create(). Like
+ * bfexec_run(), the instance's RW segments, BSS and TLS block are restored
+ * before the application is started, so every run starts from the same
+ * state (unless funcs->heap_reset was set, see bfexec_run).
+ *
+ * @param instance the instance to execute
+ * @param argc the number of arguments to pass to ELF file on start
+ * @param argv the arguments to pass to the ELF file on start
+ * @return the application's return value on success, BFFAILURE otherwise
+ */
+static inline status_t
+bfexec_instance_run(
+    struct bfexec_instance_t *instance,
+    int argc,
+    const char **argv)
+{
+    struct _start_args_t _start_args = {0};
+
+    if (instance == nullptr) {
+        BFALERT("bfexec_instance_run failed: invalid instance\n");
+        return BFFAILURE;
+    }
+
+    if (instance->image->funcs.heap_reset != 0 && instance->heap != nullptr) {
+        _start_args.heap_reset = 1;
+    }
+
+    if (_start_args.heap_reset == 0 || instance->started == 0) {
+        if (private_bfexec_instance_reset(instance) != BFSUCCESS) {
+            BFALERT("bfexec_instance_run failed: failed to relocate the instance\n");
+            return BFFAILURE;
+        }
+
+        if (instance->tls != nullptr) {
+            private_memset(instance->tls, 0, BFTLS_ALLOC_SIZE);
+        }
+
+        instance->started = BFSCAST(uint8_t, _start_args.heap_reset);
+    }
+
+    _start_args.argc = argc;
+    _start_args.argv = argv;
+    _start_args.exec = instance->exec;
+    _start_args.tls = instance->tls;
+    _start_args.stack = instance->stack;
+    _start_args.heap = instance->heap;
+    _start_args.alloc = instance->image->funcs.alloc;
+    _start_args.free = instance->image->funcs.free;
+    _start_args.syscall = instance->image->funcs.syscall;
+    _start_args.set_thread_pointer = instance->image->funcs.set_thread_pointer;
+    _start_args.get_thread_pointer = instance->image->funcs.get_thread_pointer;
+
+    return bfexecs(&instance->ef, &_start_args);
+}
+
 #endif
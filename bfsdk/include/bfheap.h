@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2019 Assured Information Security, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file bfheap.h
+ */
+
+#ifndef BFHEAP_H
+#define BFHEAP_H
+
+#include "bftypes.h"
+#include "bfheapstats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Number of Bins
+ *
+ * The number of bins the runtime's allocator keeps its free pages in, which
+ * a checkpoint has to save.
+ */
+#define BFHEAP_NUM_BINS 128
+
+/**
+ * @struct bfheap_checkpoint_t
+ *
+ * The state of the heap when bfheap_checkpoint() was called. All of the
+ * fields in this structure are private and should not be used directly.
+ */
+struct bfheap_checkpoint_t {
+    uint64_t cursor;
+    uint64_t seal;
+    void *chunks;
+    void *sealed_chunks;
+    uint64_t grow_pages;
+    uint64_t current_bytes;
+    void *deferred;
+    void *spare_spans;
+    void *bins[BFHEAP_NUM_BINS];
+    uint64_t bins_used[BFHEAP_NUM_BINS / 64];
+    void *slabs[BFHEAP_NUM_CLASSES];
+};
+
+/**
+ * Heap Checkpoint
+ *
+ * Records the current state of the heap so that it can later be restored
+ * using bfheap_reset(). While the checkpoint is in place, everything that
+ * is allocated comes from memory that was not part of the heap when the
+ * checkpoint was taken, and the memory that was free at that time is set
+ * aside until the reset. Memory that was allocated before the checkpoint
+ * can still be freed, but it is only given back to the heap by the reset.
+ *
+ * When the application is started with _start_args_t::heap_reset set, the
+ * runtime takes a checkpoint once static initialization is complete.
+ *
+ * @param checkpoint where to store the checkpoint
+ */
+void bfheap_checkpoint(struct bfheap_checkpoint_t *checkpoint);
+
+/**
+ * Heap Reset
+ *
+ * Frees everything that was allocated since the provided checkpoint was
+ * taken (including any memory the heap grew by) with a single reset of the
+ * heap's cursor, instead of calling free() for each allocation, and
+ * restores the free memory the heap had when the checkpoint was taken.
+ * Memory that was allocated before the checkpoint and freed since is freed
+ * as well. Any pointer to memory allocated after the checkpoint is invalid
+ * once this returns, and the checkpoint cannot be reset again (take a new
+ * one instead). Checkpoints can be nested, in which case they must be reset
+ * in the reverse order in which they were taken.
+ *
+ * Note that this includes state that is initialized lazily and kept after
+ * the memory is freed, such as function-local statics that allocate, or
+ * newlib's FILEs (and their buffers) that are opened after the checkpoint.
+ * These are left pointing to freed memory, and must not be used after the
+ * reset. The runtime only takes care of this for the unwinder's caches.
+ *
+ * This is only supported by the runtime's allocator. If bfruntime was built
+ * with BAREFLANK_NEWLIB_MALLOC, this function does nothing.
+ *
+ * @param checkpoint the checkpoint to return to
+ */
+void bfheap_reset(const struct bfheap_checkpoint_t *checkpoint);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+
+#include <new>
+#include <cstddef>
+#include <cstdlib>
+
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+namespace bfpmr = std::pmr;
+#else
+#include <experimental/memory_resource>
+namespace bfpmr = std::experimental::pmr;
+#endif
+
+/**
+ * Arena Region Size
+ *
+ * The size of the first region a bfheap_arena takes from its upstream memory
+ * resource. Every region after that is twice as big as the one before it.
+ */
+#ifndef BFHEAP_ARENA_REGION_SIZE
+#define BFHEAP_ARENA_REGION_SIZE 0x10000
+#endif
+
+/**
+ * @class bfheap_arena
+ *
+ * A memory resource that takes regions of memory from an upstream memory
+ * resource (the heap, by default) and hands out memory from them by
+ * bumping a pointer, so that allocating is cheap and deallocating does
+ * nothing. All of the memory given out by the arena is freed at once when
+ * the arena is released or destroyed, by giving its regions back to the
+ * upstream resource. Since the regions are only used by the arena, memory
+ * that is allocated from the heap while the arena exists is not affected
+ * by it.
+ *
+ * Arenas can be nested by using one arena as the upstream resource of
+ * another, in which case releasing the inner arena only frees what was
+ * allocated from it, and the outer arena must outlive the inner one. An
+ * arena must not be used by more than one thread at a time.
+ */
+class bfheap_arena : public bfpmr::memory_resource
+{
+public:
+
+    bfheap_arena() noexcept :
+        bfheap_arena(BFHEAP_ARENA_REGION_SIZE, bfpmr::new_delete_resource())
+    { }
+
+    explicit bfheap_arena(bfpmr::memory_resource *upstream) noexcept :
+        bfheap_arena(BFHEAP_ARENA_REGION_SIZE, upstream)
+    { }
+
+    bfheap_arena(size_t region_size, bfpmr::memory_resource *upstream) noexcept :
+        m_region_size(region_size),
+        m_upstream(upstream)
+    { }
+
+    ~bfheap_arena() override
+    { release(); }
+
+    void release() noexcept
+    {
+        while (m_regions != nullptr) {
+            auto region = m_regions;
+            m_regions = region->next;
+
+            m_upstream->deallocate(region, region->size, alignof(std::max_align_t));
+        }
+
+        m_cursor = 0;
+        m_end = 0;
+    }
+
+    bfpmr::memory_resource *upstream_resource() const noexcept
+    { return m_upstream; }
+
+    bfheap_arena(bfheap_arena &&) = delete;
+    bfheap_arena &operator=(bfheap_arena &&) = delete;
+    bfheap_arena(const bfheap_arena &) = delete;
+    bfheap_arena &operator=(const bfheap_arena &) = delete;
+
+private:
+
+    struct region_t {
+        region_t *next;
+        size_t size;
+    };
+
+    void *do_allocate(size_t bytes, size_t alignment) override
+    {
+        auto ptr = (m_cursor + alignment - 1) & ~(alignment - 1);
+
+        if (m_regions == nullptr || ptr < m_cursor || ptr > m_end || bytes > m_end - ptr) {
+            grow(bytes, alignment);
+            ptr = (m_cursor + alignment - 1) & ~(alignment - 1);
+        }
+
+        m_cursor = ptr + bytes;
+        return reinterpret_cast<void *>(ptr);
+    }
+
+    void do_deallocate(void *ptr, size_t bytes, size_t alignment) override
+    {
+        bfignored(ptr);
+        bfignored(bytes);
+        bfignored(alignment);
+    }
+
+    bool do_is_equal(const bfpmr::memory_resource &other) const noexcept override
+    { return this == &other; }
+
+    void grow(size_t bytes, size_t alignment)
+    {
+        auto size = m_region_size;
+        auto needed = sizeof(region_t) + alignment + bytes;
+
+        if (needed < bytes) {
+            throw std::bad_alloc();
+        }
+
+        while (size < needed) {
+            if (size > SIZE_MAX / 2) {
+                throw std::bad_alloc();
+            }
+
+            size *= 2;
+        }
+
+        auto region = static_cast<region_t *>(m_upstream->allocate(size, alignof(std::max_align_t)));
+
+        region->next = m_regions;
+        region->size = size;
+        m_regions = region;
+
+        m_cursor = reinterpret_cast<uintptr_t>(region) + sizeof(region_t);
+        m_end = reinterpret_cast<uintptr_t>(region) + size;
+
+        if (size <= SIZE_MAX / 2) {
+            m_region_size = size * 2;
+        }
+    }
+
+private:
+
+    size_t m_region_size;
+    bfpmr::memory_resource *m_upstream;
+    region_t *m_regions{nullptr};
+
+    uintptr_t m_cursor{0};
+    uintptr_t m_end{0};
+};
+
+#endif
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2019 Assured Information Security, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file bfheapstats.h
+ */
+
+#ifndef BFHEAPSTATS_H
+#define BFHEAPSTATS_H
+
+#include "bftypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Number of Size Classes
+ *
+ * The number of size classes used by the runtime's allocator. Class 0 is
+ * used for allocations that are larger than the largest size class, which
+ * get their own pages.
+ */
+#define BFHEAP_NUM_CLASSES 37
+
+/**
+ * @struct heap_stats_t
+ *
+ * Counters maintained by the runtime's allocator (bfruntime) that can be
+ * used to see how much heap an application needs. Sizes are in bytes, and
+ * each allocation counts as the size of its size class (or its pages), as
+ * that is what it takes from the heap. These are not maintained if
+ * bfruntime was built with BAREFLANK_NEWLIB_MALLOC.
+ *
+ * @var heap_stats_t::current_bytes
+ *     the number of bytes that are currently allocated
+ * @var heap_stats_t::peak_bytes
+ *     the largest value current_bytes has had
+ * @var heap_stats_t::total_bytes
+ *     the total number of bytes that have been allocated
+ * @var heap_stats_t::heap_bytes
+ *     the number of bytes the heap currently uses, including the memory
+ *     that is free but was not given back, the page maps and the memory
+ *     the heap grew by
+ * @var heap_stats_t::peak_heap_bytes
+ *     the largest value heap_bytes has had (i.e., the heap size the
+ *     application needs to run without growing its heap)
+ * @var heap_stats_t::free_bytes
+ *     the number of bytes in free runs of pages that the heap could reuse
+ *     (not counting free objects in the size classes)
+ * @var heap_stats_t::largest_free_bytes
+ *     the size of the largest run of free pages, including the part of the
+ *     heap that sbrk() has not given out yet. Comparing this with
+ *     free_bytes shows how fragmented the heap is
+ * @var heap_stats_t::chunks
+ *     the number of chunks the heap grew by
+ * @var heap_stats_t::class_size
+ *     the size of each size class (0 for class 0)
+ * @var heap_stats_t::class_allocs
+ *     the number of allocations served by each size class
+ */
+struct heap_stats_t {
+    uint64_t current_bytes;
+    uint64_t peak_bytes;
+    uint64_t total_bytes;
+    uint64_t heap_bytes;
+    uint64_t peak_heap_bytes;
+    uint64_t free_bytes;
+    uint64_t largest_free_bytes;
+    uint64_t chunks;
+    uint64_t class_size[BFHEAP_NUM_CLASSES];
+    uint64_t class_allocs[BFHEAP_NUM_CLASSES];
+};
+
+/**
+ * Heap Statistics
+ *
+ * Fills in the provided stats using the allocator's counters. Finding
+ * free_bytes and largest_free_bytes requires walking the free lists, so
+ * these (and class_size) are only filled in by this function, while the
+ * other counters can also be read directly from __g_heap_stats.
+ *
+ * If _start_args_t::heap_stats is set, this is done on exit, so that the
+ * loader can see the heap usage of the application once bfexecs() returns.
+ *
+ * @param stats where to store the stats
+ */
+void bfheap_stats(struct heap_stats_t *stats);
+
+/**
+ * Heap Statistics Counters
+ */
+extern struct heap_stats_t __g_heap_stats;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
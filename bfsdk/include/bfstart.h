@@ -28,6 +28,7 @@
 #define BFSTART_H
 
 #include "bftypes.h"
+#include "bfheapstats.h"
 
 #pragma pack(push, 1)
 
@@ -40,6 +41,16 @@
  *      the address of the eh_frame section in the ELF file
  * @var section_info_t::eh_frame_size (auto filled in)
  *      the size of the eh_frame section in the ELF file
+ * @var section_info_t::eh_frame_hdr_addr (auto filled in)
+ *      the address of the eh_frame_hdr section in the ELF file (0 if the
+ *      ELF file was not linked with --eh-frame-hdr)
+ * @var section_info_t::eh_frame_hdr_size (auto filled in)
+ *      the size of the eh_frame_hdr section in the ELF file
+ * @var section_info_t::unwind_table_addr (auto filled in)
+ *      the address of the compact unwind table (0 if the ELF file was not
+ *      compiled using bfcompile)
+ * @var section_info_t::unwind_table_size (auto filled in)
+ *      the size of the compact unwind table
  * @var section_info_t::init_array_addr (auto filled in)
  *      the address of the init section in the ELF file
  * @var section_info_t::init_array_size (auto filled in)
@@ -65,15 +76,39 @@
  * @var section_info_t::thread_id (default to 0)
  *      the ID of the application's thread when started (usually 0)
  * @var section_info_t::alloc (optional)
- *      the alloc function to use when allocating the TLS block, stack or heap
+ *      the alloc function to use when allocating the TLS block, stack or heap.
+ *      The application also uses it to grow its heap once the heap is full
+ *      (memory returned by alloc should be page aligned).
  * @var section_info_t::free (optional)
- *      the free function to use when freeing the TLS block, stack or heap
+ *      the free function to use when freeing the TLS block, stack or heap.
+ *      The application uses it to free the memory it added to its heap
+ *      when it exits.
  * @var section_info_t::syscall (optional)
  *      the syscall function to use when a syscall is made.
+ * @var section_info_t::set_thread_pointer (optional)
+ *      the function used to set the GS base to the thread context when
+ *      BFTHREAD_CONTEXT_GS is defined (see bfexec.h)
+ * @var section_info_t::get_thread_pointer (optional)
+ *      the function used to read the GS base when BFTHREAD_CONTEXT_GS is
+ *      defined, so that it can be restored once the application returns
+ *      (see bfexec.h)
+ * @var section_info_t::heap_reset (default to 0)
+ *      if set to 1, the application takes a heap checkpoint once static
+ *      initialization is complete (see bfheap.h), and every time it is
+ *      started after that (with the same exec, TLS block, stack and heap,
+ *      and without restoring its RW segments), it skips static
+ *      initialization, resets its heap to the checkpoint and calls main()
+ * @var section_info_t::heap_stats (optional)
+ *      if set, the application fills this in with its heap statistics
+ *      when it exits (see bfheapstats.h)
  */
 struct _start_args_t {
     uint64_t eh_frame_addr;
     uint64_t eh_frame_size;
+    uint64_t eh_frame_hdr_addr;
+    uint64_t eh_frame_hdr_size;
+    uint64_t unwind_table_addr;
+    uint64_t unwind_table_size;
     uint64_t init_array_addr;
     uint64_t init_array_size;
     uint64_t fini_array_addr;
@@ -89,6 +124,10 @@ struct _start_args_t {
     void *(*alloc)(size_t size);
     void (*free)(void *ptr, size_t size);
     void (*syscall)(uint64_t id, void *args);
+    void (*set_thread_pointer)(uint64_t ptr);
+    uint64_t (*get_thread_pointer)(void);
+    uint64_t heap_reset;
+    struct heap_stats_t *heap_stats;
 };
 
 #ifdef __cplusplus
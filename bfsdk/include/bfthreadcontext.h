@@ -70,6 +70,8 @@ uint64_t _sp(void) NOEXCEPT;
  *      the id of the thread
  * @var thread_context_t::original_sp
  *      the original stack pointer
+ * @var thread_context_t::self
+ *      a pointer to this structure (used when BFTHREAD_CONTEXT_GS is defined)
  * @var thread_context_t::reserved
  *      reserved
  */
@@ -78,17 +80,62 @@ struct thread_context_t {
     uint64_t *tlsptr;
     uint64_t thread_id;
     uint64_t original_sp;
-    uint64_t reserved[4];
+    struct thread_context_t *self;
+    uint64_t reserved[3];
 };
 
 #ifdef __cplusplus
 static_assert(sizeof(struct thread_context_t) == 64);
 #endif
 
+/*
+ * Thread Context Using GS
+ *
+ * By default, the thread context is found by rounding the current stack
+ * pointer up to BFSTACK_SIZE, which is why each stack must be naturally
+ * aligned (and is allocated using twice its size to ensure this), and
+ * why finding the thread context requires a call to _sp(). If
+ * BFTHREAD_CONTEXT_GS is defined (this must be defined for both the loader
+ * and the application), the GS base is set to the thread context instead
+ * (see bfexecs), and the thread context is read using GS, which does not
+ * require the stack to be aligned, so the stack is allocated using its
+ * size. GS is used and not FS, as FS holds the TLS of the host's C library
+ * on Linux, which is still used whenever the application calls back into
+ * the loader (e.g., a syscall).
+ */
+
+#ifdef BFTHREAD_CONTEXT_GS
+#define BFTC_TLSPTR_OFFSET 8
+#define BFTC_THREAD_ID_OFFSET 16
+#define BFTC_SELF_OFFSET 32
+#endif
+
 /**
  * @cond
  */
 
+#ifdef BFTHREAD_CONTEXT_GS
+
+#define BFSTACK_ALLOC_SIZE BFSTACK_SIZE
+
+static inline uint64_t
+__tc_tos(uint64_t sp)
+{ return (sp + BFSTACK_ALLOC_SIZE) & ~BFSCAST(uint64_t, 0x3F); }
+
+static inline uint64_t
+__tc_bos(uint64_t sp)
+{ return (sp + 0x3F) & ~BFSCAST(uint64_t, 0x3F); }
+
+static inline uint64_t
+__tc_gs_read(void) NOEXCEPT
+{
+    uint64_t val;
+    __asm__("mov %%gs:%c1, %0" : "=r"(val) : "i"(BFTC_SELF_OFFSET));
+    return val;
+}
+
+#else
+
 #define BFSTACK_ALLOC_SIZE (BFSTACK_SIZE * 2)
 
 static inline uint64_t
@@ -107,6 +154,8 @@ static inline uint64_t
 __tc_bocs()
 { return __tc_tocs() - BFSTACK_SIZE; }
 
+#endif
+
 /**
  * @endcond
  */
@@ -121,6 +170,54 @@ static inline struct thread_context_t *
 thread_context_ptr(uint64_t tos)
 { return BFRCAST(struct thread_context_t *, tos - sizeof(struct thread_context_t)); }
 
+#ifdef BFTHREAD_CONTEXT_GS
+
+/**
+ * Current Thread Context
+ *
+ * @return returns a pointer to the current thread's context structure
+ */
+static inline struct thread_context_t *
+thread_context_cur(void) NOEXCEPT
+{ return BFRCAST(struct thread_context_t *, __tc_gs_read()); }
+
+/**
+ * Thread Context ID
+ *
+ * @return returns the current thread's ID
+ */
+static inline uint64_t
+thread_id(void) NOEXCEPT
+{
+    uint64_t id;
+    __asm__("mov %%gs:%c1, %0" : "=r"(id) : "i"(BFTC_THREAD_ID_OFFSET));
+    return id;
+}
+
+/**
+ * Thread Context TLS Pointer
+ *
+ * @return returns a pointer to the current thread's TLS block
+ */
+static inline uint64_t *
+thread_local_storage_ptr(void) NOEXCEPT
+{
+    uint64_t *tlsptr;
+    __asm__("mov %%gs:%c1, %0" : "=r"(tlsptr) : "i"(BFTC_TLSPTR_OFFSET));
+    return tlsptr;
+}
+
+#else
+
+/**
+ * Current Thread Context
+ *
+ * @return returns a pointer to the current thread's context structure
+ */
+static inline struct thread_context_t *
+thread_context_cur(void) NOEXCEPT
+{ return thread_context_ptr(__tc_tocs()); }
+
 /**
  * Thread Context ID
  *
@@ -139,6 +236,8 @@ static inline uint64_t *
 thread_local_storage_ptr(void) NOEXCEPT
 { return thread_context_ptr(__tc_tocs())->tlsptr; }
 
+#endif
+
 /**
  * Setup Stack
  *
@@ -180,6 +279,7 @@ setup_stack(void *stack, uint64_t id, void *tlsptr) NOEXCEPT
     struct thread_context_t *tc = thread_context_ptr(__tc_tos(sp));
     tc->thread_id = id;
     tc->tlsptr = BFSCAST(uint64_t *, tlsptr);
+    tc->self = tc;
 
     /**
      * The following sets up our stack canaries. We place a canary at the top
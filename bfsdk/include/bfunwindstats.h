@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2019 Assured Information Security, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file bfunwindstats.h
+ */
+
+#ifndef BFUNWINDSTATS_H
+#define BFUNWINDSTATS_H
+
+#include "bftypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @struct unwind_stats_t
+ *
+ * Counters maintained by the unwinder (bfunwind) that can be used to see
+ * how much work a throw costs. All times are in TSC ticks.
+ *
+ * @var unwind_stats_t::fde_lookups
+ *     the total number of FDE lookups performed by the unwinder
+ * @var unwind_stats_t::fde_index_builds
+ *     the number of times the FDE index was built (should be 0 or 1). The
+ *     index is only needed when the ELF file has no .eh_frame_hdr section
+ * @var unwind_stats_t::fde_index_entries
+ *     the number of FDEs in the FDE index
+ * @var unwind_stats_t::fde_index_build_time
+ *     the total time spent building the FDE index
+ * @var unwind_stats_t::cfi_cache_hits
+ *     the number of frames that were unwound using a cached CFI table row
+ * @var unwind_stats_t::cfi_cache_misses
+ *     the number of frames whose CFI instructions had to be decoded
+ * @var unwind_stats_t::unwind_table_hits
+ *     the number of frames that were unwound using the compact unwind table
+ *     generated by bfcompile (these frames do not touch the CFI cache)
+ */
+struct unwind_stats_t {
+    uint64_t fde_lookups;
+    uint64_t fde_index_builds;
+    uint64_t fde_index_entries;
+    uint64_t fde_index_build_time;
+    uint64_t cfi_cache_hits;
+    uint64_t cfi_cache_misses;
+    uint64_t unwind_table_hits;
+};
+
+/**
+ * Unwind Statistics
+ */
+extern struct unwind_stats_t __g_unwind_stats;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
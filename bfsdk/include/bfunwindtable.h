@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2019 Assured Information Security, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/**
+ * @file bfunwindtable.h
+ */
+
+#ifndef BFUNWINDTABLE_H
+#define BFUNWINDTABLE_H
+
+#include "bftypes.h"
+
+#pragma pack(push, 1)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Compact Unwind Table
+ *
+ * bfcompile pre-interprets the .eh_frame section of an ELF file into a
+ * table of these entries, which it appends to the loaded image. Each entry
+ * describes how to unwind a range of PCs without decoding any DWARF. The
+ * entries are sorted by PC, and an entry covers every PC that is greater
+ * than its PC, up to and including the PC of the next entry (i.e., the
+ * range (pc, next pc]). This matches how the unwinder looks up return
+ * addresses, which point one past the call, so an entry for a row that
+ * starts at address X must use X - 1 as its PC (bfcompile does this for
+ * every row except the first row of an FDE).
+ *
+ * Only rows that are made up of a CFA that is a register plus an offset,
+ * and callee-saved registers (and the return address) that are stored at
+ * an offset from the CFA are described (which covers the prologues that
+ * compilers generate for x86_64). For everything else, cfa_register is set
+ * to UNWIND_TABLE_DWARF and the unwinder falls back to decoding the DWARF.
+ *
+ * @var unwind_table_entry_t::pc
+ *     the PC the range starts after, relative to the start of the table
+ * @var unwind_table_entry_t::cfa_offset
+ *     the offset that is added to cfa_register to get the CFA
+ * @var unwind_table_entry_t::cfa_register
+ *     the DWARF register number the CFA is based on, or UNWIND_TABLE_DWARF
+ * @var unwind_table_entry_t::saved
+ *     for rbx, rbp, r12, r13, r14, r15 and the return address (in that
+ *     order), where the register is stored relative to the CFA, in units of
+ *     8 bytes (0 means the register was not saved)
+ */
+struct unwind_table_entry_t {
+    int32_t pc;
+    int32_t cfa_offset;
+    uint8_t cfa_register;
+    int8_t saved[7];
+};
+
+#define UNWIND_TABLE_DWARF 0xFF
+
+#ifdef __cplusplus
+}
+#endif
+
+#pragma pack(pop)
+
+#endif
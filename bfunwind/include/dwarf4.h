@@ -26,8 +26,22 @@
 #include "eh_frame.h"
 #include "registers_intel_x64.h"
 
+#include <bfunwindtable.h>
+
 #define MAX_ROWS 17
 
+#ifndef CFI_CACHE_SIZE
+#define CFI_CACHE_SIZE 64
+#endif
+
+#ifndef CFI_CACHE_MAX_REGISTERS
+#define CFI_CACHE_MAX_REGISTERS 17
+#endif
+
+#if ((CFI_CACHE_SIZE & (CFI_CACHE_SIZE - 1)) != 0)
+#error CFI_CACHE_SIZE must be a power of 2
+#endif
+
 // -----------------------------------------------------------------------------
 // Overview
 // -----------------------------------------------------------------------------
@@ -135,6 +149,12 @@
 //   because a throw might be due to bad_alloc. For this reason, GCC does
 //   not output these instructions so we should be fine here.
 //
+// Since decoding the instructions has to start from the CIE's initial
+// instructions every time, and most applications throw from the same few
+// locations over and over, the resulting row (the CFA and the registers that
+// have a rule) is cached using the PC. Repeated throws through the same
+// frames then skip decoding entirely. The cache has CFI_CACHE_SIZE entries.
+//
 
 // -----------------------------------------------------------------------------
 // Call Frame Information (section 6.4.1)
@@ -381,6 +401,22 @@ public:
     /// @param state the current state of the registers
     ///
     static void unwind(const fd_entry &fde, register_state *state = nullptr);
+
+    /// Compact
+    ///
+    /// Decodes the CFI table row that applies to pc, and converts it into a
+    /// compact unwind table entry (see bfunwindtable.h). If the row cannot
+    /// be described by a compact entry, the entry's cfa_register is set to
+    /// UNWIND_TABLE_DWARF. The entry's pc is not filled in as it is relative
+    /// to the location of the table. This is used by bfcompile to generate
+    /// the compact unwind table offline.
+    ///
+    /// @param fde the FDE that describes pc
+    /// @param pc the PC to decode the row for
+    /// @param entry the resulting compact unwind table entry
+    /// @return the PC of the next row in the FDE (or the end of the FDE)
+    ///
+    static uint64_t compact(const fd_entry &fde, uint64_t pc, unwind_table_entry_t *entry);
 };
 
 #endif
@@ -54,9 +54,12 @@ class fd_entry;
 //
 // Notes:
 //
-// - This implementation is not optimized for performance. Exception handling
-//   in bareflank should not be used for flow control, but rather for error
-//   handling (which should not happen often)
+// - Exception handling in bareflank should not be used for flow control,
+//   but rather for error handling (which should not happen often). That
+//   said, the cost of a throw should depend on the depth of the stack and
+//   not the size of the executable, so FDEs are located using a binary
+//   search of the .eh_frame_hdr section when the linker provides one (see
+//   below), and a sorted index of the .eh_frame section otherwise.
 //
 // - The specification is written for 32bit and 64bit. This implementation
 //   only supports 64bit.
@@ -195,6 +198,62 @@ uint64_t decode_pointer(char **addr, uint64_t encoding);
 //
 // https://en.wikipedia.org/wiki/LEB128
 
+// -----------------------------------------------------------------------------
+// .eh_frame_hdr Section (section 10.6.2)
+// -----------------------------------------------------------------------------
+//
+// When an executable is linked with --eh-frame-hdr, the linker emits an
+// .eh_frame_hdr section (and a PT_GNU_EH_FRAME segment that points to it),
+// which has the following format:
+//
+//         .eh_frame_hdr
+// ---------------------------
+// - version (1)             -
+// - eh_frame_ptr_enc        -
+// - fde_count_enc           -
+// - table_enc               -
+// - eh_frame_ptr            -
+// - fde_count               -
+// - binary search table     -
+// ---------------------------
+//
+// The binary search table contains fde_count (initial location, FDE address)
+// pairs, sorted by initial location, which allows the FDE for a given PC to
+// be located in O(log n) instead of walking the entire .eh_frame section.
+// In practice, the table is always encoded as DW_EH_PE_datarel |
+// DW_EH_PE_sdata4 (i.e. signed 32bit offsets from the start of the
+// .eh_frame_hdr section), which is the only table encoding we search. If the
+// table is missing, or uses a different encoding, we fall back to a linear
+// scan of the .eh_frame section.
+//
+// Since a linear scan is expensive, the first time an FDE cannot be located
+// using the .eh_frame_hdr section, the .eh_frame section is walked once to
+// build a sorted index of FDEs which is then binary searched instead. The
+// index is stored in a static reserve of FDE_INDEX_RESERVE entries, and is
+// only allocated from the heap if the executable has more FDEs than that.
+//
+
+// Also note that there are usually only a handful of CIEs in an executable
+// (the linker merges duplicates), while there are thousands of FDEs. For this
+// reason, each CIE is parsed once and stored in a cache of CIE_CACHE_SIZE
+// entries, keyed by the CIE's address, and each FDE references the cached
+// CIE instead of parsing (and storing) its own copy. If an executable has
+// more CIEs than that, the remaining CIEs are parsed into nodes allocated
+// from the heap (which are only forgotten when the runtime resets the heap,
+// see _unwind_heap_reset), and an FDE whose CIE cannot be allocated is
+// treated as having no PC range, and is never matched.
+//
+
+#define EH_FRAME_HDR_VERSION 1
+
+#ifndef CIE_CACHE_SIZE
+#define CIE_CACHE_SIZE 64
+#endif
+
+#ifndef FDE_INDEX_RESERVE
+#define FDE_INDEX_RESERVE 4096
+#endif
+
 /// Exception Header Framework
 ///
 /// This is a pretty simple class. The entire .eh_frame ELF section exists
@@ -598,10 +657,13 @@ public:
 
     /// CIE
     ///
+    /// Note: CIEs are cached, so the CIE returned by this function remains
+    /// valid for the lifetime of the executable, even if this FDE does not.
+    ///
     /// @return returns the CIE associated with this FDE.
     ///
     const ci_entry &cie() const
-    { return m_cie; }
+    { return *m_cie; }
 
 protected:
     void parse(char *addr) override;
@@ -613,7 +675,7 @@ private:
     uint64_t m_lsda;
     char *m_instructions;
 
-    ci_entry m_cie;
+    const ci_entry *m_cie;
 };
 
 #endif
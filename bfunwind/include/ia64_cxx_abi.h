@@ -26,6 +26,20 @@
 
 struct _Unwind_Exception;
 
+// -----------------------------------------------------------------------------
+// Configuration
+// -----------------------------------------------------------------------------
+
+// During phase 1, the FDE and register state of each frame that is visited
+// is recorded so that phase 2 can replay them instead of looking up and
+// decoding the same frames a second time. This defines how many frames are
+// recorded (the buffer lives on the stack of _Unwind_RaiseException). Any
+// frames beyond this limit are unwound again in phase 2 as usual.
+
+#ifndef UNWIND_FRAME_CACHE_SIZE
+#define UNWIND_FRAME_CACHE_SIZE 8
+#endif
+
 // -----------------------------------------------------------------------------
 // Overview
 // -----------------------------------------------------------------------------
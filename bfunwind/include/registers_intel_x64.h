@@ -152,6 +152,9 @@ public:
     uint64_t max_num_registers() const override
     { return 17; }
 
+    const registers_intel_x64_t &registers() const
+    { return m_registers; }
+
     const char *name(uint64_t index) const override
     {
         if (index >= max_num_registers()) {
@@ -31,6 +31,9 @@
 #include <abort.h>
 #include <dwarf4.h>
 
+#include <bfunwindstats.h>
+#include <bfunwindtable.h>
+
 // -----------------------------------------------------------------------------
 // Helpers
 // -----------------------------------------------------------------------------
@@ -199,6 +202,174 @@ private:
     cfi_register m_registers[MAX_NUM_REGISTERS];
 };
 
+// -----------------------------------------------------------------------------
+// Call Frame Information (CFI) Cache
+// -----------------------------------------------------------------------------
+
+// A decoded table row only depends on the PC (and the FDE which is also
+// determined by the PC), so once a row has been decoded, it can be stored
+// and reused the next time the same PC is unwound. The cache is direct
+// mapped and only stores the CFA and the registers that have a rule, which
+// is usually the return address and a couple of callee saved registers.
+// The cache is shared between threads. If another thread is using the cache,
+// we simply decode the row instead of waiting.
+
+struct cfi_cache_entry {
+    uint64_t pc;
+    cfi_cfa cfa;
+    uint64_t arg_size;
+    uint64_t num_registers;
+    cfi_register registers[CFI_CACHE_MAX_REGISTERS];
+};
+
+static cfi_cache_entry g_cfi_cache[CFI_CACHE_SIZE];
+static int64_t g_cfi_cache_lock = 0;
+
+static uint64_t
+private_cfi_cache_index(uint64_t pc)
+{ return (pc ^ (pc >> 12)) & (CFI_CACHE_SIZE - 1); }
+
+static bool
+private_cfi_cache_find(uint64_t pc, cfi_cache_entry *entry)
+{
+    auto found = false;
+
+    if (!__sync_bool_compare_and_swap(&g_cfi_cache_lock, 0, 1)) {
+        return false;
+    }
+
+    if (const auto &cached = g_cfi_cache[private_cfi_cache_index(pc)]; cached.pc == pc) {
+        *entry = cached;
+        found = true;
+    }
+
+    __sync_lock_release(&g_cfi_cache_lock);
+    return found;
+}
+
+static void
+private_cfi_cache_insert(const cfi_cache_entry &entry)
+{
+    if (!__sync_bool_compare_and_swap(&g_cfi_cache_lock, 0, 1)) {
+        return;
+    }
+
+    g_cfi_cache[private_cfi_cache_index(entry.pc)] = entry;
+    __sync_lock_release(&g_cfi_cache_lock);
+}
+
+// -----------------------------------------------------------------------------
+// Compact Unwind Table
+// -----------------------------------------------------------------------------
+
+// The compact unwind table (see bfunwindtable.h) is generated by bfcompile
+// using dwarf4::compact() and is searched before any CFI is decoded. An
+// entry covers the PCs that are greater than its PC, up to and including
+// the PC of the next entry, which is the same convention that is used to
+// match a PC to an FDE (see fd_entry::is_in_range). The saved registers in
+// each entry are stored in the following order.
+
+static const uint64_t g_unwind_table_registers[] = {
+    0x03, 0x06, 0x0C, 0x0D, 0x0E, 0x0F, 0x10
+};
+
+static_assert(
+    sizeof(g_unwind_table_registers) / sizeof(uint64_t) == sizeof(unwind_table_entry_t::saved));
+
+static const unwind_table_entry_t *
+private_find_unwind_table_entry(uint64_t pc)
+{
+    auto base = reinterpret_cast<uint64_t>(__g_eh_frame.table_addr);
+    auto table = static_cast<const unwind_table_entry_t *>(__g_eh_frame.table_addr);
+    auto size = __g_eh_frame.table_size / sizeof(unwind_table_entry_t);
+
+    if (table == nullptr) {
+        return nullptr;
+    }
+
+    const unwind_table_entry_t *result = nullptr;
+
+    uint64_t low = 0;
+    uint64_t high = size;
+
+    while (low < high) {
+        auto mid = low + ((high - low) / 2);
+
+        if (add_offset(base, table[mid].pc) < pc) {
+            result = &table[mid];
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    if (result == nullptr || result->cfa_register == UNWIND_TABLE_DWARF) {
+        return nullptr;
+    }
+
+    return result;
+}
+
+static bool
+private_compact_table_entry(const cfi_table_row &row, unwind_table_entry_t *entry)
+{
+    const auto &cfa = row.cfa();
+
+    if (cfa.type() != cfi_cfa::cfa_register || cfa.value() >= UNWIND_TABLE_DWARF) {
+        return false;
+    }
+
+    if (cfa.offset() < INT32_MIN || cfa.offset() > INT32_MAX || row.arg_size() != 0) {
+        return false;
+    }
+
+    entry->cfa_offset = static_cast<int32_t>(cfa.offset());
+    entry->cfa_register = static_cast<uint8_t>(cfa.value());
+
+    for (auto i = 0U; i < MAX_NUM_REGISTERS; i++) {
+        const auto &reg = row.reg(i);
+
+        if (reg.rule() == rule_undefined || reg.rule() == rule_same_value) {
+            continue;
+        }
+
+        auto offset = static_cast<int64_t>(reg.value());
+        if (reg.rule() != rule_offsetn || (offset % 8) != 0 || offset < -1024 || offset > 1016) {
+            return false;
+        }
+
+        auto found = false;
+        for (auto j = 0U; j < sizeof(entry->saved); j++) {
+            if (g_unwind_table_registers[j] == i) {
+                entry->saved[j] = static_cast<int8_t>(offset / 8);
+                found = true;
+            }
+        }
+
+        if (!found || offset == 0) {
+            return false;
+        }
+    }
+
+    return entry->saved[sizeof(entry->saved) - 1] != 0;
+}
+
+static void
+private_unwind_table_unwind(const unwind_table_entry_t &entry, register_state *state)
+{
+    auto cfa = add_offset(state->get(entry.cfa_register), entry.cfa_offset);
+
+    for (auto i = 0U; i < sizeof(entry.saved); i++) {
+        if (entry.saved[i] != 0) {
+            auto addr = add_offset(cfa, entry.saved[i] * 8);
+            state->set(g_unwind_table_registers[i], *reinterpret_cast<uint64_t *>(addr));
+        }
+    }
+
+    state->commit(cfa);
+}
+
 // -----------------------------------------------------------------------------
 // Unwind Helpers
 // -----------------------------------------------------------------------------
@@ -1162,10 +1333,9 @@ private_parse_expression(char *p,
 }
 
 static uint64_t
-private_decode_cfa(const cfi_table_row &row, register_state *state)
+private_decode_cfa(const cfi_cfa &cfa, register_state *state)
 {
     uint64_t value = 0;
-    const auto &cfa = row.cfa();
 
     switch (cfa.type()) {
         case cfi_cfa::cfa_register:
@@ -1229,14 +1399,12 @@ private_parse_instruction(cfi_table_row *row,
                           const uint64_t *l1,
                           uint64_t *l2,
                           uint64_t pc_begin,
-                          register_state *state,
                           uint64_t &rememberIndex,
                           cfi_table_row *rememberStack,
                           cfi_table_row *initialRow)
 {
     (void) l1;
     (void) pc_begin;
-    (void) state;
 
     uint8_t opcode = *reinterpret_cast<uint8_t *>(*p) & 0xC0;
     uint8_t operand = *reinterpret_cast<uint8_t *>(*p) & 0x3F;
@@ -1443,11 +1611,12 @@ static void
 private_parse_instructions(cfi_table_row *row,
                            const ci_entry &cie,
                            const fd_entry &fde,
-                           register_state *state,
-                           bool is_cie)
+                           uint64_t pc,
+                           bool is_cie,
+                           uint64_t *next = nullptr)
 {
     uint64_t pc_begin = is_cie ? 0 : fde.pc_begin();
-    uint64_t l1 = is_cie ? 0ULL : state->get_ip() - fde.pc_begin();
+    uint64_t l1 = is_cie ? 0ULL : pc - fde.pc_begin();
     uint64_t l2 = 0ULL;
 
     char *p = is_cie ? cie.initial_instructions() : fde.instructions();
@@ -1460,22 +1629,54 @@ private_parse_instructions(cfi_table_row *row,
 
     while (p < end && l1 >= l2) {
         private_parse_instruction(
-            row, cie, &p, &l1, &l2, pc_begin, state, rememberIndex, rememberStack, &initialRow);
+            row, cie, &p, &l1, &l2, pc_begin, rememberIndex, rememberStack, &initialRow);
+    }
+
+    if (next != nullptr && p < end && l2 > l1 && l2 < fde.pc_range()) {
+        *next = fde.pc_begin() + l2;
     }
 }
 
 cfi_table_row
-private_decode_cfi(const fd_entry &fde, register_state *state)
+private_decode_cfi(const fd_entry &fde, uint64_t pc, uint64_t *next = nullptr)
 {
     auto row = cfi_table_row();
     const auto &cie = fde.cie();
 
-    private_parse_instructions(&row, cie, fde, state, true);
-    private_parse_instructions(&row, cie, fde, state, false);
+    private_parse_instructions(&row, cie, fde, pc, true);
+    private_parse_instructions(&row, cie, fde, pc, false, next);
 
     return row;
 }
 
+static bool
+private_compact_cfi(const cfi_table_row &row,
+                    uint64_t pc,
+                    register_state *state,
+                    cfi_cache_entry *entry)
+{
+    entry->pc = pc;
+    entry->cfa = row.cfa();
+    entry->arg_size = row.arg_size();
+    entry->num_registers = 0;
+
+    for (auto i = 0U; i < state->max_num_registers(); i++) {
+        const auto &reg = row.reg(i);
+
+        if (reg.rule() == rule_undefined) {
+            continue;
+        }
+
+        if (entry->num_registers >= CFI_CACHE_MAX_REGISTERS) {
+            return false;
+        }
+
+        entry->registers[entry->num_registers++] = reg;
+    }
+
+    return true;
+}
+
 // -----------------------------------------------------------------------------
 // DWARF 4 Implementation
 // -----------------------------------------------------------------------------
@@ -1533,20 +1734,54 @@ dwarf4::unwind(const fd_entry &fde, register_state *state)
         return;
     }
 
-    auto row = private_decode_cfi(fde, state);
-    auto cfa = private_decode_cfa(row, state);
+    auto pc = state->get_ip();
 
-    for (auto i = 0U; i < state->max_num_registers(); i++) {
-        auto reg = row.reg(i);
+    if (auto table_entry = private_find_unwind_table_entry(pc)) {
+        __g_unwind_stats.unwind_table_hits++;
+        private_unwind_table_unwind(*table_entry, state);
 
-        if (reg.rule() == rule_undefined) {
-            continue;
+        return;
+    }
+
+    auto entry = cfi_cache_entry();
+
+    if (private_cfi_cache_find(pc, &entry)) {
+        __g_unwind_stats.cfi_cache_hits++;
+    }
+    else {
+        __g_unwind_stats.cfi_cache_misses++;
+
+        if (private_compact_cfi(private_decode_cfi(fde, pc), pc, state, &entry)) {
+            private_cfi_cache_insert(entry);
         }
+        else {
+            ABORT("too many registers in cfi table row. increase CFI_CACHE_MAX_REGISTERS");
+        }
+    }
+
+    auto cfa = private_decode_cfa(entry.cfa, state);
+
+    for (auto i = 0U; i < entry.num_registers; i++) {
+        const auto &reg = entry.registers[i];
+        state->set(reg.index(), private_decode_reg(reg, cfa, state));
+    }
+
+    state->commit(cfa + entry.arg_size);
+}
+
+uint64_t
+dwarf4::compact(const fd_entry &fde, uint64_t pc, unwind_table_entry_t *entry)
+{
+    auto next = fde.pc_begin() + fde.pc_range();
+    auto row = private_decode_cfi(fde, pc, &next);
 
-        state->set(i, private_decode_reg(reg, cfa, state));
+    *entry = {};
+    if (!private_compact_table_entry(row, entry)) {
+        *entry = {};
+        entry->cfa_register = UNWIND_TABLE_DWARF;
     }
 
-    state->commit(cfa + row.arg_size());
+    return next;
 }
 
 #ifndef __clang__
@@ -33,6 +33,17 @@
 #include <eh_frame.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <algorithm>
+
+#include <bfunwindstats.h>
+
+// -----------------------------------------------------------------------------
+// Global Resources
+// -----------------------------------------------------------------------------
+
+unwind_stats_t __g_unwind_stats = {};
 
 // -----------------------------------------------------------------------------
 // Helpers
@@ -141,7 +152,7 @@ common_entry::common_entry() :
     m_entry_end(nullptr),
     m_payload_start(nullptr),
     m_payload_end(nullptr),
-    m_eh_frame{nullptr, 0}
+    m_eh_frame{}
 {
 }
 
@@ -326,6 +337,79 @@ ci_entry::non_virtual_parse(char *addr)
     m_initial_instructions = p;
 }
 
+// -----------------------------------------------------------------------------
+// CIE Cache
+// -----------------------------------------------------------------------------
+
+static ci_entry g_invalid_cie;
+
+static ci_entry g_cie_cache[CIE_CACHE_SIZE];
+static uint64_t g_cie_cache_size = 0;
+static int64_t g_cie_cache_lock = 0;
+
+struct cie_overflow_t {
+    ci_entry cie;
+    cie_overflow_t *next;
+};
+
+static cie_overflow_t *g_cie_overflow = nullptr;
+
+static const ci_entry *
+private_find_cie_overflow(const eh_frame_t &eh_frame, char *addr)
+{
+    for (auto node = g_cie_overflow; node != nullptr; node = node->next) {
+        if (node->cie.entry_start() == addr) {
+            return &node->cie;
+        }
+    }
+
+    auto node = static_cast<cie_overflow_t *>(malloc(sizeof(cie_overflow_t)));
+    if (node == nullptr) {
+        return &g_invalid_cie;
+    }
+
+    new (&node->cie) ci_entry(eh_frame, addr);
+    node->next = g_cie_overflow;
+    g_cie_overflow = node;
+
+    return &node->cie;
+}
+
+static const ci_entry *
+private_find_cie(const eh_frame_t &eh_frame, char *addr)
+{
+    auto size = __atomic_load_n(&g_cie_cache_size, __ATOMIC_ACQUIRE);
+
+    for (auto i = 0ULL; i < size; i++) {
+        if (g_cie_cache[i].entry_start() == addr) {
+            return &g_cie_cache[i];
+        }
+    }
+
+    while (!__sync_bool_compare_and_swap(&g_cie_cache_lock, 0, 1))
+    { }
+
+    for (auto i = size; i < g_cie_cache_size; i++) {
+        if (g_cie_cache[i].entry_start() == addr) {
+            __sync_lock_release(&g_cie_cache_lock);
+            return &g_cie_cache[i];
+        }
+    }
+
+    if ((size = g_cie_cache_size) >= CIE_CACHE_SIZE) {
+        auto cie = private_find_cie_overflow(eh_frame, addr);
+
+        __sync_lock_release(&g_cie_cache_lock);
+        return cie;
+    }
+
+    g_cie_cache[size] = ci_entry(eh_frame, addr);
+    __atomic_store_n(&g_cie_cache_size, size + 1, __ATOMIC_RELEASE);
+
+    __sync_lock_release(&g_cie_cache_lock);
+    return &g_cie_cache[size];
+}
+
 // -----------------------------------------------------------------------------
 // Frame Description Entry Record (FDE)
 // -----------------------------------------------------------------------------
@@ -334,7 +418,8 @@ fd_entry::fd_entry() :
     m_pc_begin(0),
     m_pc_range(0),
     m_lsda(0),
-    m_instructions(nullptr)
+    m_instructions(nullptr),
+    m_cie(&g_invalid_cie)
 {
 }
 
@@ -344,7 +429,8 @@ fd_entry::fd_entry(const eh_frame_t &eh_frame) :
     m_pc_begin(0),
     m_pc_range(0),
     m_lsda(0),
-    m_instructions(nullptr)
+    m_instructions(nullptr),
+    m_cie(&g_invalid_cie)
 {
     non_virtual_parse(reinterpret_cast<char *>(eh_frame.addr));
 }
@@ -355,7 +441,8 @@ fd_entry::fd_entry(const eh_frame_t &eh_frame, void *addr) :
     m_pc_begin(0),
     m_pc_range(0),
     m_lsda(0),
-    m_instructions(nullptr)
+    m_instructions(nullptr),
+    m_cie(&g_invalid_cie)
 {
     non_virtual_parse(reinterpret_cast<char *>(addr));
 }
@@ -382,19 +469,23 @@ fd_entry::non_virtual_parse(char *addr)
     auto p = payload_start();
     auto p_cie = reinterpret_cast<char *>(reinterpret_cast<uint64_t>(p) - *reinterpret_cast<uint32_t *>(p));
 
-    m_cie = ci_entry(eh_frame(), p_cie);
+    m_cie = private_find_cie(eh_frame(), p_cie);
     p += sizeof(uint32_t);
 
-    m_pc_begin = decode_pointer(&p, m_cie.pointer_encoding());
-    m_pc_range = decode_pointer(&p, m_cie.pointer_encoding() & 0xF);
+    if (!*m_cie) {
+        return;
+    }
+
+    m_pc_begin = decode_pointer(&p, m_cie->pointer_encoding());
+    m_pc_range = decode_pointer(&p, m_cie->pointer_encoding() & 0xF);
 
-    if (m_cie.augmentation_string(0) == 'z') {
+    if (m_cie->augmentation_string(0) == 'z') {
         auto len = dwarf4::decode_uleb128(&p);
 
-        for (auto i = 1U; m_cie.augmentation_string(i) != 0 && i <= len; i++) {
-            switch (m_cie.augmentation_string(i)) {
+        for (auto i = 1U; m_cie->augmentation_string(i) != 0 && i <= len; i++) {
+            switch (m_cie->augmentation_string(i)) {
                 case 'L':
-                    m_lsda = decode_pointer(&p, m_cie.lsda_encoding());
+                    m_lsda = decode_pointer(&p, m_cie->lsda_encoding());
                     break;
 
                 case 'P':
@@ -416,19 +507,247 @@ fd_entry::non_virtual_parse(char *addr)
 // Exception Handler Framework (eh_frame)
 // -----------------------------------------------------------------------------
 
-fd_entry
-eh_frame::find_fde(register_state *state)
+struct eh_frame_hdr_entry {
+    int32_t initial_location;
+    int32_t address;
+};
+
+static bool
+private_find_fde_hdr(uint64_t pc, fd_entry *result)
+{
+    auto hdr = reinterpret_cast<char *>(__g_eh_frame.hdr_addr);
+
+    if (hdr == nullptr || __g_eh_frame.hdr_size < 4) {
+        return false;
+    }
+
+    auto version = *reinterpret_cast<uint8_t *>(hdr + 0);
+    auto eh_frame_ptr_enc = *reinterpret_cast<uint8_t *>(hdr + 1);
+    auto fde_count_enc = *reinterpret_cast<uint8_t *>(hdr + 2);
+    auto table_enc = *reinterpret_cast<uint8_t *>(hdr + 3);
+
+    if (version != EH_FRAME_HDR_VERSION) {
+        return false;
+    }
+
+    if (fde_count_enc == DW_EH_PE_omit ||
+        table_enc != (DW_EH_PE_datarel | DW_EH_PE_sdata4)) {
+        return false;
+    }
+
+    auto p = hdr + 4;
+    decode_pointer(&p, eh_frame_ptr_enc);
+    auto fde_count = decode_pointer(&p, fde_count_enc);
+
+    if (fde_count == 0) {
+        return false;
+    }
+
+    // The FDE that contains the PC is the last entry in the table whose
+    // initial location is less than the PC (see fd_entry::is_in_range for
+    // why this is not less than or equal).
+
+    auto table = reinterpret_cast<eh_frame_hdr_entry *>(p);
+    auto base = reinterpret_cast<int64_t>(hdr);
+
+    uint64_t lo = 0;
+    uint64_t hi = fde_count;
+
+    while (lo < hi) {
+        auto mid = lo + ((hi - lo) >> 1);
+
+        if (static_cast<uint64_t>(base + table[mid].initial_location) < pc) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    if (lo != 0) {
+        auto addr = reinterpret_cast<void *>(base + table[lo - 1].address);
+
+        if (auto fde = fd_entry(__g_eh_frame, addr); fde && fde.is_in_range(pc)) {
+            *result = fde;
+        }
+    }
+
+    return true;
+}
+
+// The FDE index is a sorted copy of every FDE's PC range that is built the
+// first time it is needed (i.e. on the first throw) when the ELF file does not
+// have an .eh_frame_hdr section. Unless the executable has more than
+// FDE_INDEX_RESERVE FDEs, the index lives in a static reserve so that
+// building it does not depend on the heap (we might be throwing bad_alloc).
+// If the index cannot be allocated, it is never built, and every lookup
+// walks the .eh_frame section instead of trying (and failing) again.
+
+struct fde_index_entry {
+    uint64_t pc_begin;
+    uint32_t pc_range;
+    uint32_t fde_offset;
+};
+
+enum fde_index_state {
+    fde_index_unbuilt = 0,
+    fde_index_built = 1,
+    fde_index_unavailable = 2
+};
+
+static fde_index_entry g_fde_index_reserve[FDE_INDEX_RESERVE];
+
+static fde_index_entry *g_fde_index = nullptr;
+static uint64_t g_fde_index_size = 0;
+static int64_t g_fde_index_state = fde_index_unbuilt;
+static int64_t g_fde_index_lock = 0;
+
+static int64_t
+private_build_fde_index()
+{
+    uint64_t n = 0;
+    auto eh_frame_addr = reinterpret_cast<uint64_t>(__g_eh_frame.addr);
+
+    for (auto fde = fd_entry(__g_eh_frame); fde; ++fde) {
+        if (fde.is_fde()) {
+            n++;
+        }
+    }
+
+    if (n == 0) {
+        return fde_index_unavailable;
+    }
+
+    auto index = g_fde_index_reserve;
+    if (n > FDE_INDEX_RESERVE) {
+        index = static_cast<fde_index_entry *>(malloc(n * sizeof(fde_index_entry)));
+        if (index == nullptr) {
+            return fde_index_unavailable;
+        }
+    }
+
+    n = 0;
+    for (auto fde = fd_entry(__g_eh_frame); fde; ++fde) {
+        if (fde.is_cie()) {
+            continue;
+        }
+
+        auto offset = reinterpret_cast<uint64_t>(fde.entry_start()) - eh_frame_addr;
+
+        if (fde.pc_range() > UINT32_MAX || offset > UINT32_MAX) {
+            if (index != g_fde_index_reserve) {
+                free(index);
+            }
+
+            return fde_index_unavailable;
+        }
+
+        index[n++] = {
+            fde.pc_begin(), static_cast<uint32_t>(fde.pc_range()), static_cast<uint32_t>(offset)
+        };
+    }
+
+    std::sort(index, index + n, [](const auto &a, const auto &b) {
+        return a.pc_begin < b.pc_begin;
+    });
+
+    g_fde_index = index;
+    g_fde_index_size = n;
+
+    return fde_index_built;
+}
+
+static bool
+private_fde_index_ready()
+{
+    auto state = __atomic_load_n(&g_fde_index_state, __ATOMIC_ACQUIRE);
+    if (state != fde_index_unbuilt) {
+        return state == fde_index_built;
+    }
+
+    while (!__sync_bool_compare_and_swap(&g_fde_index_lock, 0, 1))
+    { }
+
+    if ((state = g_fde_index_state) == fde_index_unbuilt) {
+        auto start = __builtin_ia32_rdtsc();
+        state = private_build_fde_index();
+
+        __g_unwind_stats.fde_index_builds++;
+        __g_unwind_stats.fde_index_entries = g_fde_index_size;
+        __g_unwind_stats.fde_index_build_time += __builtin_ia32_rdtsc() - start;
+
+        __atomic_store_n(&g_fde_index_state, state, __ATOMIC_RELEASE);
+    }
+
+    __sync_lock_release(&g_fde_index_lock);
+    return state == fde_index_built;
+}
+
+static bool
+private_find_fde_index(uint64_t pc, fd_entry *result)
+{
+    if (!private_fde_index_ready()) {
+        return false;
+    }
+
+    uint64_t lo = 0;
+    uint64_t hi = g_fde_index_size;
+
+    while (lo < hi) {
+        auto mid = lo + ((hi - lo) >> 1);
+
+        if (g_fde_index[mid].pc_begin < pc) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    if (lo != 0) {
+        const auto &entry = g_fde_index[lo - 1];
+
+        if (pc <= entry.pc_begin + entry.pc_range) {
+            *result = fd_entry(
+                __g_eh_frame, reinterpret_cast<char *>(__g_eh_frame.addr) + entry.fde_offset);
+        }
+    }
+
+    return true;
+}
+
+static fd_entry
+private_find_fde_linear(uint64_t pc)
 {
     for (auto fde = fd_entry(__g_eh_frame); fde; ++fde) {
         if (fde.is_cie()) {
             continue;
         }
 
-        if (fde.is_in_range(state->get_ip())) {
+        if (fde.is_in_range(pc)) {
             return fde;
         }
     }
 
+    return fd_entry();
+}
+
+fd_entry
+eh_frame::find_fde(register_state *state)
+{
+    auto fde = fd_entry();
+    __g_unwind_stats.fde_lookups++;
+
+    if (!private_find_fde_hdr(state->get_ip(), &fde)) {
+        if (!private_find_fde_index(state->get_ip(), &fde)) {
+            fde = private_find_fde_linear(state->get_ip());
+        }
+    }
+
+    if (fde) {
+        return fde;
+    }
+
     printf("ERROR: An exception was thrown, but the unwinder was unable to "
            "locate a stack frame for RIP = %p. Possible reasons include\n",
            reinterpret_cast<void *>(state->get_ip()));
@@ -441,3 +760,36 @@ eh_frame::find_fde(register_state *state)
 
     return fd_entry();
 }
+
+// -----------------------------------------------------------------------------
+// Heap Reset
+// -----------------------------------------------------------------------------
+
+// The FDE index (when it does not fit in its reserve) and the CIEs that do
+// not fit in the CIE cache are allocated from the heap the first time they
+// are needed, which is usually during main(). When the runtime resets the
+// heap between runs of a resumable application (see _start_args_t), this
+// memory is freed, so the runtime calls this function to forget about it,
+// and it is allocated again by the next run that needs it.
+
+extern "C" void
+_unwind_heap_reset(void) noexcept
+{
+    while (!__sync_bool_compare_and_swap(&g_fde_index_lock, 0, 1))
+    { }
+
+    if (g_fde_index_state == fde_index_built && g_fde_index != g_fde_index_reserve) {
+        g_fde_index = nullptr;
+        g_fde_index_size = 0;
+
+        __atomic_store_n(&g_fde_index_state, fde_index_unbuilt, __ATOMIC_RELEASE);
+    }
+
+    __sync_lock_release(&g_fde_index_lock);
+
+    while (!__sync_bool_compare_and_swap(&g_cie_cache_lock, 0, 1))
+    { }
+
+    g_cie_overflow = nullptr;
+    __sync_lock_release(&g_cie_cache_lock);
+}
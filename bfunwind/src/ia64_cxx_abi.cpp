@@ -37,14 +37,34 @@
 // Context
 // -----------------------------------------------------------------------------
 
+// The frames that phase 1 visited. Phase 2 visits the exact same frames (it
+// starts from the same register state and stops at the handler that phase 1
+// found), so instead of looking up each FDE and decoding each frame's CFI a
+// second time, phase 2 replays what phase 1 recorded. If the stack is deeper
+// than the buffer, phase 2 continues from the last recorded frame by
+// unwinding as usual.
+
+struct _Unwind_Frame {
+    fd_entry fde;
+    registers_intel_x64_t registers;
+};
+
+struct _Unwind_Frames {
+    uint64_t size{0};
+    uint64_t next{0};
+    _Unwind_Frame frames[UNWIND_FRAME_CACHE_SIZE];
+};
+
 struct _Unwind_Context {
     fd_entry fde;
-    register_state *state;
+    register_state_intel_x64 *state;
     _Unwind_Exception *exception_object;
+    _Unwind_Frames *frames;
 
-    _Unwind_Context(register_state *s, _Unwind_Exception *eo) :
+    _Unwind_Context(register_state_intel_x64 *s, _Unwind_Exception *eo, _Unwind_Frames *f = nullptr) :
         state(s),
-        exception_object(eo)
+        exception_object(eo),
+        frames(f)
     {
     }
 };
@@ -67,6 +87,35 @@ private_personality(_Unwind_Action action, _Unwind_Context *context)
     return _URC_CONTINUE_UNWIND;
 }
 
+static void
+private_record_frame(_Unwind_Context *context)
+{
+    auto frames = context->frames;
+
+    if (frames == nullptr || frames->size >= UNWIND_FRAME_CACHE_SIZE) {
+        return;
+    }
+
+    frames->frames[frames->size++] = {context->fde, context->state->registers()};
+}
+
+static bool
+private_replay_frame(_Unwind_Context *context)
+{
+    auto frames = context->frames;
+
+    if (frames == nullptr || frames->next >= frames->size) {
+        return false;
+    }
+
+    const auto &frame = frames->frames[frames->next++];
+
+    context->fde = frame.fde;
+    *context->state = register_state_intel_x64(frame.registers);
+
+    return true;
+}
+
 // -----------------------------------------------------------------------------
 // Implementation
 // -----------------------------------------------------------------------------
@@ -99,6 +148,8 @@ private_phase1(_Unwind_Context *context)
             return result;
         }
 
+        private_record_frame(context);
+
         switch (private_personality(_UA_SEARCH_PHASE, context)) {
             case _URC_HANDLER_FOUND:
                 context->exception_object->private_1 = context->fde.pc_begin();
@@ -120,20 +171,22 @@ private_phase2(_Unwind_Context *context)
 {
     auto result = _URC_CONTINUE_UNWIND;
 
-    result = find_and_store_fde(context);
-    if (result != _URC_CONTINUE_UNWIND) {
-        return result;
-    }
-
-    dwarf4::unwind(context->fde, context->state);
+    if (!private_replay_frame(context)) {
+        result = find_and_store_fde(context);
+        if (result != _URC_CONTINUE_UNWIND) {
+            return result;
+        }
 
-    while (true) {
-        auto action = _UA_CLEANUP_PHASE;
+        dwarf4::unwind(context->fde, context->state);
 
         result = find_and_store_fde(context);
         if (result != _URC_CONTINUE_UNWIND) {
             return result;
         }
+    }
+
+    while (true) {
+        auto action = _UA_CLEANUP_PHASE;
 
         if (context->exception_object->private_1 == context->fde.pc_begin()) {
             action |= _UA_HANDLER_FRAME;
@@ -150,7 +203,16 @@ private_phase2(_Unwind_Context *context)
                 ABORT("phase 2 personality routine failed");
         }
 
+        if (private_replay_frame(context)) {
+            continue;
+        }
+
         dwarf4::unwind(context->fde, context->state);
+
+        result = find_and_store_fde(context);
+        if (result != _URC_CONTINUE_UNWIND) {
+            return result;
+        }
     }
 }
 
@@ -165,8 +227,9 @@ _Unwind_RaiseException(_Unwind_Exception *exception_object)
     exception_object->private_1 = 0;
     exception_object->private_2 = 0;
 
+    auto frames = _Unwind_Frames();
     auto state = register_state_intel_x64(registers);
-    auto context = _Unwind_Context(&state, exception_object);
+    auto context = _Unwind_Context(&state, exception_object, &frames);
 
     ret = private_phase1(&context);
     if (ret != _URC_NO_REASON) {
@@ -174,7 +237,7 @@ _Unwind_RaiseException(_Unwind_Exception *exception_object)
     }
 
     state = register_state_intel_x64(registers);
-    context = _Unwind_Context(&state, exception_object);
+    context = _Unwind_Context(&state, exception_object, &frames);
 
     ret = private_phase2(&context);
     if (ret != _URC_NO_REASON) {
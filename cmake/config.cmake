@@ -99,6 +99,14 @@ if(NOT BAREFLANK_STACK_SIZE)
     set(BAREFLANK_STACK_SIZE 32768)
 endif()
 
+if(NOT BAREFLANK_THREAD_CONTEXT_GS)
+    set(BAREFLANK_THREAD_CONTEXT_GS OFF)
+endif()
+
+if(NOT BAREFLANK_NEWLIB_MALLOC)
+    set(BAREFLANK_NEWLIB_MALLOC OFF)
+endif()
+
 # ------------------------------------------------------------------------------
 # CMake Switches
 # ------------------------------------------------------------------------------
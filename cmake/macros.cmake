@@ -303,7 +303,11 @@ function(setup_interfaces)
     add_library(standalone_cxx INTERFACE)
     add_library(standalone_cxx_sdk INTERFACE)
 
+    # bfruntime is listed first so that its malloc (which is pulled in by
+    # _start) is found before newlib's.
+
     target_link_libraries(standalone_cxx INTERFACE
+        ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/lib/libbfruntime.a
         ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/lib/libc++.a
         ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/lib/libc++abi.a
         ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/lib/libbfunwind.a
@@ -335,6 +339,7 @@ function(setup_interfaces)
     target_compile_definitions(standalone_cxx_sdk INTERFACE
         BFHEAP_SIZE=${BAREFLANK_HEAP_SIZE}
         BFSTACK_SIZE=${BAREFLANK_STACK_SIZE}
+        $<$<BOOL:${BAREFLANK_THREAD_CONTEXT_GS}>:BFTHREAD_CONTEXT_GS>
     )
 
     target_compile_options(standalone_cxx_sdk INTERFACE
@@ -399,6 +404,8 @@ function(generate_toolchain TOOLCHAIN_INPUT TOOLCHAIN_OUTPUT)
     file(APPEND ${TOOLCHAIN_OUTPUT} "set(BAREFLANK_LD_BIN ${BAREFLANK_LD_BIN})\n")
     file(APPEND ${TOOLCHAIN_OUTPUT} "set(BAREFLANK_HEAP_SIZE ${BAREFLANK_HEAP_SIZE})\n")
     file(APPEND ${TOOLCHAIN_OUTPUT} "set(BAREFLANK_STACK_SIZE ${BAREFLANK_STACK_SIZE})\n")
+    file(APPEND ${TOOLCHAIN_OUTPUT} "set(BAREFLANK_THREAD_CONTEXT_GS ${BAREFLANK_THREAD_CONTEXT_GS})\n")
+    file(APPEND ${TOOLCHAIN_OUTPUT} "set(BAREFLANK_NEWLIB_MALLOC ${BAREFLANK_NEWLIB_MALLOC})\n")
     file(APPEND ${TOOLCHAIN_OUTPUT} "# --- Auto Generated ---\n")
     file(APPEND ${TOOLCHAIN_OUTPUT} "\n")
 
@@ -104,6 +104,30 @@ add_custom_target(
     ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/bin/hello_bareflank
 )
 
+add_custom_target(
+    test_bfexecv_stream
+    COMMAND ${BAREFLANK_PREFIX_DIR}/host/bin/bfexecv_stream
+    ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/bin/hello_bareflank
+)
+
+add_custom_target(
+    test_bfexec_prepare
+    COMMAND ${BAREFLANK_PREFIX_DIR}/host/bin/bfexec_prepare
+    ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/bin/hello_bareflank
+)
+
+add_custom_target(
+    test_bfexec_instances
+    COMMAND ${BAREFLANK_PREFIX_DIR}/host/bin/bfexec_instances
+    ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/bin/hello_bareflank
+)
+
+add_custom_target(
+    test_bfexec_lazy
+    COMMAND ${BAREFLANK_PREFIX_DIR}/host/bin/bfexec_lazy
+    ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/bin/hello_bareflank
+)
+
 add_custom_target(
     test_empty
     COMMAND ${BAREFLANK_PREFIX_DIR}/host/bin/bfexec
@@ -127,3 +151,46 @@ add_custom_target(
     COMMAND ${BAREFLANK_PREFIX_DIR}/host/bin/bfexec
     ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/bin/hello_world
 )
+
+add_custom_target(
+    test_aligned_new
+    COMMAND ${BAREFLANK_PREFIX_DIR}/host/bin/bfexec
+    ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/bin/aligned_new
+)
+
+add_custom_target(
+    test_heap_grow
+    COMMAND ${BAREFLANK_PREFIX_DIR}/host/bin/bfexec
+    ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/bin/heap_grow
+)
+
+add_custom_target(
+    test_heap_arena
+    COMMAND ${BAREFLANK_PREFIX_DIR}/host/bin/bfexec
+    ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/bin/heap_arena
+)
+
+# ------------------------------------------------------------------------------
+# Benchmarks
+# ------------------------------------------------------------------------------
+
+add_custom_target(
+    bench_memops
+    COMMAND ${BAREFLANK_PREFIX_DIR}/host/bin/bench_memops
+)
+
+add_custom_target(
+    bench_relocate
+    COMMAND ${BAREFLANK_PREFIX_DIR}/host/bin/bench_relocate
+)
+
+add_custom_target(
+    bench_parallel
+    COMMAND ${BAREFLANK_PREFIX_DIR}/host/bin/bench_parallel
+)
+
+add_custom_target(
+    bench_malloc
+    COMMAND ${BAREFLANK_PREFIX_DIR}/host/bin/bfexec
+    ${BAREFLANK_PREFIX_DIR}/${BAREFLANK_TARGET}/bin/bench_malloc
+)
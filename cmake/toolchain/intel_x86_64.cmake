@@ -52,6 +52,13 @@ string(CONCAT BAREFLANK_TARGET_CLANG_FLAGS
     "-DBFSTACK_SIZE=${BAREFLANK_STACK_SIZE} "
 )
 
+if(BAREFLANK_THREAD_CONTEXT_GS)
+    string(CONCAT BAREFLANK_TARGET_CLANG_FLAGS
+        "-DBFTHREAD_CONTEXT_GS "
+        "${BAREFLANK_TARGET_CLANG_FLAGS}"
+    )
+endif()
+
 if(${BAREFLANK_TARGET_BUILD_TYPE} MATCHES "MinSizeRel")
     string(CONCAT BAREFLANK_TARGET_CLANG_FLAGS
         "-Os "
@@ -93,6 +100,7 @@ string(CONCAT BAREFLANK_TARGET_LD_FLAGS
     "-static "
     "-pie "
     "--no-dynamic-linker "
+    "--eh-frame-hdr "
     "-nostdlib "
     "-z max-page-size=0x1000 "
     "-z noexecstack "
@@ -0,0 +1,101 @@
+//
+// Copyright (C) 2019 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <bfelf_loader.h>
+
+// -----------------------------------------------------------------------------
+// Benchmark
+// -----------------------------------------------------------------------------
+
+// Compares the memcpy/memset implementations that bfelf_file_load() can be
+// compiled with (see BFELF_LOADER_MEMOPS) by zeroing and then copying an
+// image of the provided size (in MB), which is what bfelf_file_load() does
+// with every image it loads.
+
+using memcpy_t = void (*)(void *, const void *, bfelf64_xword);
+using memset_t = void (*)(void *, uint8_t, bfelf64_xword);
+
+template<typename F>
+double
+time(F func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void
+bench(const char *name, memcpy_t cpy, memset_t set, std::vector<uint8_t> &dst, const std::vector<uint8_t> &src)
+{
+    auto size = dst.size();
+
+    // Offsetting the copy by a byte makes sure the unaligned head and tail
+    // of each implementation is both exercised and verified.
+
+    auto set_ms = time([&] { set(dst.data(), 0, size); });
+    auto cpy_ms = time([&] { cpy(dst.data() + 1, src.data(), size - 2); });
+
+    if (dst.front() != 0 || dst.back() != 0 || std::memcmp(dst.data() + 1, src.data(), size - 2) != 0) {
+        printf("%-6s FAILED\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-6s memset: %8.2f ms  memcpy: %8.2f ms\n", name, set_ms, cpy_ms);
+}
+
+int main(int argc, const char *argv[])
+{
+    auto mb = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 64ULL;
+
+    auto src = std::vector<uint8_t>(mb << 20);
+    auto dst = std::vector<uint8_t>(mb << 20);
+
+    for (auto i = 0ULL; i < src.size(); i++) {
+        src.at(i) = static_cast<uint8_t>((i * 131) ^ (i >> 12));
+    }
+
+    // Touch the destination once so that page faults are not charged to
+    // whichever implementation happens to run first.
+
+    std::memset(dst.data(), 0xFF, dst.size());
+    printf("image size: %llu MB\n", mb);
+
+    bench("byte", private_memcpy_byte, private_memset_byte, dst, src);
+    bench("word", private_memcpy_word, private_memset_word, dst, src);
+
+#ifdef BFELF_LOADER_HAS_REP
+    bench("rep", private_memcpy_rep, private_memset_rep, dst, src);
+#endif
+
+#ifdef BFELF_LOADER_HAS_SSE2
+    bench("sse2", private_memcpy_sse2, private_memset_sse2, dst, src);
+#endif
+
+    return EXIT_SUCCESS;
+}
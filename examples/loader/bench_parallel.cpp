@@ -0,0 +1,249 @@
+//
+// Copyright (C) 2019 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <bfelf_loader.h>
+#include "thread_pool.h"
+
+// -----------------------------------------------------------------------------
+// Benchmark
+// -----------------------------------------------------------------------------
+
+// Loads a synthetic image using 1 to N threads (default: the number of
+// cores), and reports the time it takes to copy the image (default 256MB)
+// into place, and to relocate it with the provided number of relocations
+// (default 4M), using both .rela.dyn and RELR. The results are checked
+// against the expected values, so this also makes sure that splitting the
+// work into chunks does not change the result.
+
+constexpr bfelf64_addr virt = 0x40000000;
+thread_pool *g_pool = nullptr;
+
+void
+parallel_for(void (*func)(void *, bfelf64_xword), void *ctx, bfelf64_xword num)
+{ g_pool->run(func, ctx, num); }
+
+template<typename F>
+double
+time(F func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+std::vector<bfelf64_addr>
+make_offsets(bfelf64_addr data, uint64_t num)
+{
+    std::vector<bfelf64_addr> offsets;
+
+    for (auto i = 0ULL; offsets.size() < num; i++) {
+        if (i % 3 != 2) {
+            offsets.push_back(data + (i * sizeof(bfelf64_addr)));
+        }
+    }
+
+    return offsets;
+}
+
+std::vector<bfelf_relr>
+make_relr(const std::vector<bfelf64_addr> &offsets)
+{
+    std::vector<bfelf_relr> table;
+
+    for (auto iter = offsets.begin(); iter != offsets.end();) {
+        auto where = *iter + sizeof(bfelf64_addr);
+        table.push_back(*iter++);
+
+        while (true) {
+            bfelf_relr bitmap = 0;
+
+            for (; iter != offsets.end(); ++iter) {
+                auto delta = *iter - where;
+                if (delta >= BFELF_RELR_BITS * sizeof(bfelf64_addr)) {
+                    break;
+                }
+
+                bitmap |= 1ULL << (delta / sizeof(bfelf64_addr));
+            }
+
+            if (bitmap == 0) {
+                break;
+            }
+
+            table.push_back((bitmap << 1) | 1);
+            where += BFELF_RELR_BITS * sizeof(bfelf64_addr);
+        }
+    }
+
+    return table;
+}
+
+struct image_t {
+    std::vector<uint8_t> image;
+    std::vector<bfelf64_addr> offsets;
+    struct bfelf_file_t ef;
+};
+
+image_t
+make_rela_image(uint64_t num)
+{
+    image_t ret{};
+
+    auto data = BFALIGN(0x1000 + (num * sizeof(struct bfelf_rela)), 0x1000);
+    ret.offsets = make_offsets(data, num);
+    ret.image = std::vector<uint8_t>(ret.offsets.back() + sizeof(bfelf64_addr));
+
+    for (auto i = 0ULL; i < ret.offsets.size(); i++) {
+        auto rela = bfelf_rela{ret.offsets.at(i), BFR_X86_64_RELATIVE, 0};
+        std::memcpy(&ret.image.at(0x1000 + (i * sizeof(rela))), &rela, sizeof(rela));
+        std::memcpy(&ret.image.at(ret.offsets.at(i)), &ret.offsets.at(i), sizeof(bfelf64_addr));
+    }
+
+    ret.ef.rela_array_addr = 0x1000;
+    ret.ef.rela_array_size = num * sizeof(struct bfelf_rela);
+
+    return ret;
+}
+
+image_t
+make_relr_image(uint64_t num)
+{
+    image_t ret{};
+
+    auto relr_size = make_relr(make_offsets(0, num)).size() * sizeof(bfelf_relr);
+    auto data = BFALIGN(0x1000 + relr_size, 0x1000);
+    ret.offsets = make_offsets(data, num);
+    ret.image = std::vector<uint8_t>(ret.offsets.back() + sizeof(bfelf64_addr));
+
+    auto relr = make_relr(ret.offsets);
+    std::memcpy(&ret.image.at(0x1000), relr.data(), relr_size);
+
+    for (auto offset : ret.offsets) {
+        std::memcpy(&ret.image.at(offset), &offset, sizeof(bfelf64_addr));
+    }
+
+    ret.ef.relr_array_addr = 0x1000;
+    ret.ef.relr_array_size = relr_size;
+
+    return ret;
+}
+
+double
+bench_relocate(const char *name, const image_t &orig)
+{
+    auto img = orig;
+    img.ef.exec = img.image.data();
+    img.ef.parallel_for = parallel_for;
+
+    auto ms = time([&] {
+        if (bfelf_file_relocate(&img.ef, virt) != BFSUCCESS) {
+            printf("%s: FAILED\n", name);
+            exit(EXIT_FAILURE);
+        }
+    });
+
+    for (auto offset : img.offsets) {
+        bfelf64_addr value;
+        std::memcpy(&value, &img.image.at(offset), sizeof(value));
+
+        if (value != offset + virt) {
+            printf("%s: FAILED\n", name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return ms;
+}
+
+double
+bench_copy(const std::vector<uint8_t> &src, std::vector<uint8_t> &dst)
+{
+    struct bfelf_file_t ef = {};
+    ef.parallel_for = parallel_for;
+
+    std::memset(dst.data(), 0, dst.size());
+
+    auto ms = time([&] {
+        private_load_copy(&ef, dst.data(), src.data(), src.size());
+    });
+
+    if (std::memcmp(src.data(), dst.data(), src.size()) != 0) {
+        printf("copy: FAILED\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return ms;
+}
+
+int main(int argc, const char *argv[])
+{
+    auto max = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : std::thread::hardware_concurrency();
+    auto size = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 0x10000000ULL;
+    auto num = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 4000000ULL;
+
+    printf("copy: %llu bytes  relocations: %llu\n", size, num);
+
+    auto src = std::vector<uint8_t>(size);
+    auto dst = std::vector<uint8_t>(size);
+
+    for (auto i = 0ULL; i < size; i++) {
+        src.at(i) = static_cast<uint8_t>(i * 7);
+    }
+
+    auto rela = make_rela_image(num);
+    auto relr = make_relr_image(num);
+
+    double copy_1 = 0;
+    double rela_1 = 0;
+    double relr_1 = 0;
+
+    for (auto threads = 1ULL; threads <= max; threads++) {
+        auto pool = std::make_unique<thread_pool>(threads);
+        g_pool = pool.get();
+
+        auto copy_ms = bench_copy(src, dst);
+        auto rela_ms = bench_relocate("rela", rela);
+        auto relr_ms = bench_relocate("relr", relr);
+
+        if (threads == 1) {
+            copy_1 = copy_ms;
+            rela_1 = rela_ms;
+            relr_1 = relr_ms;
+        }
+
+        printf("threads: %3llu  copy: %8.2f ms (%5.2fx)  rela: %8.2f ms (%5.2fx)  relr: %8.2f ms (%5.2fx)\n",
+            threads,
+            copy_ms, copy_1 / copy_ms,
+            rela_ms, rela_1 / rela_ms,
+            relr_ms, relr_1 / relr_ms);
+    }
+
+    return EXIT_SUCCESS;
+}
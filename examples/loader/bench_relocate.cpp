@@ -0,0 +1,175 @@
+//
+// Copyright (C) 2019 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <bfelf_loader.h>
+
+// -----------------------------------------------------------------------------
+// Benchmark
+// -----------------------------------------------------------------------------
+
+// Relocates a synthetic image with the provided number of relocations
+// (default 1M) using bfelf_file_relocate(), once using .rela.dyn, and once
+// using an equivalent RELR table, and reports the time per relocation. The
+// image contains the relocation table followed by the words that are
+// relocated, with every third word skipped so that the RELR table contains
+// both addresses and bitmaps.
+
+constexpr bfelf64_addr virt = 0x40000000;
+
+template<typename F>
+double
+time(F func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+std::vector<bfelf64_addr>
+make_offsets(bfelf64_addr data, uint64_t num)
+{
+    std::vector<bfelf64_addr> offsets;
+
+    for (auto i = 0ULL; offsets.size() < num; i++) {
+        if (i % 3 != 2) {
+            offsets.push_back(data + (i * sizeof(bfelf64_addr)));
+        }
+    }
+
+    return offsets;
+}
+
+std::vector<bfelf_relr>
+make_relr(const std::vector<bfelf64_addr> &offsets)
+{
+    std::vector<bfelf_relr> table;
+
+    for (auto iter = offsets.begin(); iter != offsets.end();) {
+        auto where = *iter + sizeof(bfelf64_addr);
+        table.push_back(*iter++);
+
+        while (true) {
+            bfelf_relr bitmap = 0;
+
+            for (; iter != offsets.end(); ++iter) {
+                auto delta = *iter - where;
+                if (delta >= BFELF_RELR_BITS * sizeof(bfelf64_addr)) {
+                    break;
+                }
+
+                bitmap |= 1ULL << (delta / sizeof(bfelf64_addr));
+            }
+
+            if (bitmap == 0) {
+                break;
+            }
+
+            table.push_back((bitmap << 1) | 1);
+            where += BFELF_RELR_BITS * sizeof(bfelf64_addr);
+        }
+    }
+
+    return table;
+}
+
+void
+bench(const char *name, std::vector<uint8_t> &image, struct bfelf_file_t ef, const std::vector<bfelf64_addr> &offsets)
+{
+    ef.exec = image.data();
+
+    auto ns = time([&] {
+        if (bfelf_file_relocate(&ef, virt) != BFSUCCESS) {
+            printf("%-6s FAILED\n", name);
+            exit(EXIT_FAILURE);
+        }
+    });
+
+    for (auto offset : offsets) {
+        bfelf64_addr value;
+        std::memcpy(&value, &image.at(offset), sizeof(value));
+
+        if (value != offset + virt) {
+            printf("%-6s FAILED\n", name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("%-6s table: %10zu bytes  total: %8.2f ms  per relocation: %6.2f ns\n",
+        name, ef.rela_array_size + ef.relr_array_size, ns / 1000000.0, ns / static_cast<double>(offsets.size()));
+}
+
+int main(int argc, const char *argv[])
+{
+    auto num = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000ULL;
+    printf("relocations: %llu\n", num);
+
+    // The tables start at 0x1000 as bfelf_file_relocate() treats a table
+    // address of 0 as no table. Each relocated word starts out as its own
+    // offset (the addend), so once relocated, it should be offset + virt.
+
+    {
+        auto data = BFALIGN(0x1000 + (num * sizeof(struct bfelf_rela)), 0x1000);
+        auto offsets = make_offsets(data, num);
+        auto image = std::vector<uint8_t>(offsets.back() + sizeof(bfelf64_addr));
+
+        for (auto i = 0ULL; i < offsets.size(); i++) {
+            auto rela = bfelf_rela{offsets.at(i), BFR_X86_64_RELATIVE, 0};
+            std::memcpy(&image.at(0x1000 + (i * sizeof(rela))), &rela, sizeof(rela));
+            std::memcpy(&image.at(offsets.at(i)), &offsets.at(i), sizeof(bfelf64_addr));
+        }
+
+        struct bfelf_file_t ef = {};
+        ef.rela_array_addr = 0x1000;
+        ef.rela_array_size = num * sizeof(struct bfelf_rela);
+
+        bench("rela", image, ef, offsets);
+    }
+
+    {
+        auto relr_size = make_relr(make_offsets(0, num)).size() * sizeof(bfelf_relr);
+        auto data = BFALIGN(0x1000 + relr_size, 0x1000);
+        auto offsets = make_offsets(data, num);
+        auto image = std::vector<uint8_t>(offsets.back() + sizeof(bfelf64_addr));
+
+        auto relr = make_relr(offsets);
+        std::memcpy(&image.at(0x1000), relr.data(), relr_size);
+
+        for (auto offset : offsets) {
+            std::memcpy(&image.at(offset), &offset, sizeof(bfelf64_addr));
+        }
+
+        struct bfelf_file_t ef = {};
+        ef.relr_array_addr = 0x1000;
+        ef.relr_array_size = relr_size;
+
+        bench("relr", image, ef, offsets);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -21,12 +21,14 @@
 
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <asm/prctl.h>
 
-#include <vector>
-#include <fstream>
-#include <filesystem>
+#include <fcntl.h>
+#include <stdexcept>
 
 #include <bfexec.h>
+#include "thread_pool.h"
 
 // -----------------------------------------------------------------------------
 // bfexec "funcs"
@@ -36,13 +38,36 @@
 #include <cstdlib>
 #include <unistd.h>
 
+int g_fd = -1;
+thread_pool g_pool;
+
 void *
 platform_alloc(size_t size)
-{ return aligned_alloc(0x20000, size); }
+{
+    auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return nullptr;
+    }
+
+    return ptr;
+}
 
 void
 platform_free(void *ptr, size_t size)
-{ bfignored(size); return free(ptr); }
+{ munmap(ptr, size); }
+
+status_t
+platform_map_file(void *addr, bfelf64_off offset, bfelf64_xword size)
+{
+    auto ptr = mmap(
+        addr, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_FIXED, g_fd, static_cast<off_t>(offset));
+
+    if (ptr == MAP_FAILED) {
+        return BFFAILURE;
+    }
+
+    return BFSUCCESS;
+}
 
 status_t
 platform_mark_rx(void *addr, size_t size)
@@ -83,11 +108,44 @@ platform_syscall(uint64_t id, void *args)
     }
 }
 
+void
+platform_parallel_for(void (*func)(void *, bfelf64_xword), void *ctx, bfelf64_xword num)
+{ g_pool.run(func, ctx, num); }
+
+// Only used if BFTHREAD_CONTEXT_GS is defined. arch_prctl is used instead
+// of rdgsbase/wrgsbase as it works even if the kernel does not enable
+// FSGSBASE.
+
+void
+platform_set_thread_pointer(uint64_t ptr)
+{
+    if (syscall(SYS_arch_prctl, ARCH_SET_GS, ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+}
+
+uint64_t
+platform_get_thread_pointer()
+{
+    uint64_t ptr = 0;
+
+    if (syscall(SYS_arch_prctl, ARCH_GET_GS, &ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+
+    return ptr;
+}
+
 bfexec_funcs_t funcs = {
     .alloc = platform_alloc,
     .free = platform_free,
     .mark_rx = platform_mark_rx,
-    .syscall = platform_syscall
+    .syscall = platform_syscall,
+    .alloc_zeroed = 1,
+    .map_file = platform_map_file,
+    .parallel_for = platform_parallel_for,
+    .set_thread_pointer = platform_set_thread_pointer,
+    .get_thread_pointer = platform_get_thread_pointer
 };
 
 // -----------------------------------------------------------------------------
@@ -96,20 +154,25 @@ bfexec_funcs_t funcs = {
 
 int main(int argc, const char *argv[])
 {
-    std::vector<char> file;
-
     if (argc != 2) {
         throw std::runtime_error("wrong number of arguments");
     }
 
-    if (auto strm = std::ifstream(argv[1], std::fstream::binary)) {
-        auto size = std::filesystem::file_size(argv[1]);
-        file.reserve(size);
-        strm.read(file.data(), size);
-    }
-    else {
+    g_fd = open(argv[1], O_RDONLY);
+    if (g_fd < 0) {
         throw std::runtime_error("failed to open input file");
     }
 
-    return bfexec(file.data(), &funcs);
+    auto size = static_cast<size_t>(lseek(g_fd, 0, SEEK_END));
+    auto file = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, g_fd, 0);
+    if (file == MAP_FAILED) {
+        throw std::runtime_error("failed to map input file");
+    }
+
+    auto ret = bfexec(file, &funcs);
+
+    munmap(file, size);
+    close(g_fd);
+
+    return static_cast<int>(ret);
 }
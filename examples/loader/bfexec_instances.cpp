@@ -0,0 +1,228 @@
+//
+// Copyright (C) 2019 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <asm/prctl.h>
+
+#include <cstdio>
+#include <fcntl.h>
+#include <stdexcept>
+#include <vector>
+
+#include <bfexec.h>
+
+// -----------------------------------------------------------------------------
+// bfexec "funcs"
+// -----------------------------------------------------------------------------
+
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+
+bool g_quiet = false;
+
+// Memory is allocated as MAP_SHARED so that the pages of the image can be
+// mapped a second time into each instance using mremap (with an old size of
+// 0, mremap creates a new mapping of the same pages, which only works for
+// shared mappings).
+
+void *
+platform_alloc(size_t size)
+{
+    auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return nullptr;
+    }
+
+    return ptr;
+}
+
+void
+platform_free(void *ptr, size_t size)
+{ munmap(ptr, size); }
+
+status_t
+platform_mark_rx(void *addr, size_t size)
+{
+    if (mprotect(addr, size, PROT_READ|PROT_EXEC) != 0) {
+        return BFFAILURE;
+    }
+
+    return BFSUCCESS;
+}
+
+status_t
+platform_map_shared(void *dst, void *src, size_t size)
+{
+    if (mremap(src, 0, size, MREMAP_MAYMOVE | MREMAP_FIXED, dst) == MAP_FAILED) {
+        return BFFAILURE;
+    }
+
+    return BFSUCCESS;
+}
+
+void
+platform_syscall_write(bfsyscall_write_args *args)
+{
+    switch(args->fd) {
+        case STDOUT_FILENO:
+        case STDERR_FILENO:
+            if (g_quiet) {
+                args->ret = static_cast<decltype(args->ret)>(args->nbyte);
+                return;
+            }
+
+            errno = 0;
+            args->ret = write(args->fd, args->buf, args->nbyte);
+            args->error = errno;
+            return;
+
+        default:
+            return;
+    }
+}
+
+void
+platform_syscall(uint64_t id, void *args)
+{
+    switch(id) {
+        case BFSYSCALL_WRITE:
+            return platform_syscall_write(
+                static_cast<bfsyscall_write_args *>(args));
+
+        default:
+            return;
+    }
+}
+
+// Only used if BFTHREAD_CONTEXT_GS is defined. arch_prctl is used instead
+// of rdgsbase/wrgsbase as it works even if the kernel does not enable
+// FSGSBASE.
+
+void
+platform_set_thread_pointer(uint64_t ptr)
+{
+    if (syscall(SYS_arch_prctl, ARCH_SET_GS, ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+}
+
+uint64_t
+platform_get_thread_pointer()
+{
+    uint64_t ptr = 0;
+
+    if (syscall(SYS_arch_prctl, ARCH_GET_GS, &ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+
+    return ptr;
+}
+
+bfexec_funcs_t funcs = {
+    .alloc = platform_alloc,
+    .free = platform_free,
+    .mark_rx = platform_mark_rx,
+    .syscall = platform_syscall,
+    .alloc_zeroed = 1,
+    .map_shared = platform_map_shared,
+    .set_thread_pointer = platform_set_thread_pointer,
+    .get_thread_pointer = platform_get_thread_pointer
+};
+
+// -----------------------------------------------------------------------------
+// Implementation
+// -----------------------------------------------------------------------------
+
+// Creates the requested number of instances (default 16) of the provided
+// application, runs each of them (only the first instance's output is
+// shown), and reports how much of each instance is shared with the image.
+
+int main(int argc, const char *argv[])
+{
+    int num_instances = 16;
+    std::vector<bfexec_instance_t *> instances;
+
+    if (argc != 2 && argc != 3) {
+        throw std::runtime_error("wrong number of arguments");
+    }
+
+    if (argc == 3) {
+        num_instances = atoi(argv[2]);
+    }
+
+    auto fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open input file");
+    }
+
+    auto size = static_cast<size_t>(lseek(fd, 0, SEEK_END));
+    auto file = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file == MAP_FAILED) {
+        throw std::runtime_error("failed to map input file");
+    }
+
+    const char *bfargv[] = {
+        argv[1], " Fork: https://github.com/Bareflank/standalone_cxx"
+    };
+
+    auto image = bfexec_prepare(file, &funcs);
+    if (image == nullptr) {
+        throw std::runtime_error("bfexec_prepare failed");
+    }
+
+    for (auto i = 0; i < num_instances; i++) {
+        auto instance = bfexec_instance_create(image);
+        if (instance == nullptr) {
+            throw std::runtime_error("bfexec_instance_create failed");
+        }
+
+        instances.push_back(instance);
+    }
+
+    for (auto instance : instances) {
+        if (bfexec_instance_run(instance, 2, bfargv) != BFSUCCESS) {
+            throw std::runtime_error("bfexec_instance_run failed");
+        }
+
+        g_quiet = true;
+    }
+
+    if (!instances.empty()) {
+        auto shared = instances.front()->shared_size;
+        printf("instances:         %10d\n", num_instances);
+        printf("image size:        %10zu bytes\n", image->ef.size);
+        printf("shared per image:  %10zu bytes\n", shared);
+        printf("private per inst:  %10zu bytes\n", image->ef.size - shared);
+    }
+
+    for (auto instance : instances) {
+        bfexec_instance_release(instance);
+    }
+
+    bfexec_release(image);
+    munmap(file, size);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,486 @@
+//
+// Copyright (C) 2019 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <linux/userfaultfd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <asm/prctl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <bfexec.h>
+
+// -----------------------------------------------------------------------------
+// bfexec "funcs"
+// -----------------------------------------------------------------------------
+
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+
+void *
+platform_alloc(size_t size)
+{
+    auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return nullptr;
+    }
+
+    return ptr;
+}
+
+void
+platform_free(void *ptr, size_t size)
+{ munmap(ptr, size); }
+
+status_t
+platform_mark_rx(void *addr, size_t size)
+{
+    if (mprotect(addr, size, PROT_READ|PROT_EXEC) != 0) {
+        return BFFAILURE;
+    }
+
+    return BFSUCCESS;
+}
+
+void
+platform_syscall_write(bfsyscall_write_args *args)
+{
+    switch(args->fd) {
+        case STDOUT_FILENO:
+        case STDERR_FILENO:
+            errno = 0;
+            args->ret = write(args->fd, args->buf, args->nbyte);
+            args->error = errno;
+            return;
+
+        default:
+            return;
+    }
+}
+
+void
+platform_syscall(uint64_t id, void *args)
+{
+    switch(id) {
+        case BFSYSCALL_WRITE:
+            return platform_syscall_write(
+                static_cast<bfsyscall_write_args *>(args));
+
+        default:
+            return;
+    }
+}
+
+// Only used if BFTHREAD_CONTEXT_GS is defined. arch_prctl is used instead
+// of rdgsbase/wrgsbase as it works even if the kernel does not enable
+// FSGSBASE.
+
+void
+platform_set_thread_pointer(uint64_t ptr)
+{
+    if (syscall(SYS_arch_prctl, ARCH_SET_GS, ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+}
+
+uint64_t
+platform_get_thread_pointer()
+{
+    uint64_t ptr = 0;
+
+    if (syscall(SYS_arch_prctl, ARCH_GET_GS, &ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+
+    return ptr;
+}
+
+// -----------------------------------------------------------------------------
+// Lazy Image
+// -----------------------------------------------------------------------------
+
+// The image is reserved, but none of it is loaded up front. Instead, the
+// image is registered with userfaultfd, and the first time a page is
+// touched, a handler thread copies the page from the ELF file, applies the
+// relocations that fall in the page, and installs it using UFFDIO_COPY. To
+// make this fast, the relocation tables are turned into a per-page index
+// when the image is prepared, so that a fault only visits the relocations
+// of the page that was touched. The result is that startup time and RSS
+// are proportional to the pages the application actually uses.
+
+class lazy_image
+{
+    struct segment_t {
+        bfelf64_addr offset;
+        bfelf64_off file_offset;
+        bfelf64_xword filesz;
+    };
+
+public:
+
+    lazy_image(const uint8_t *file, const struct bfelf_file_t &ef) :
+        m_file{file},
+        m_exec{ef.exec},
+        m_size{ef.size},
+        m_delta{reinterpret_cast<bfelf64_addr>(ef.exec)}
+    {
+        const auto *ehdr = reinterpret_cast<const bfelf_ehdr *>(file);
+        const auto *phdrs = reinterpret_cast<const bfelf_phdr *>(file + ehdr->e_phoff);
+
+        bfelf64_addr first = 0;
+        bool found = false;
+
+        for (auto i = 0; i < ehdr->e_phnum; i++) {
+            if (phdrs[i].p_type != bfpt_load) {
+                continue;
+            }
+
+            if (!found) {
+                first = phdrs[i].p_paddr;
+                found = true;
+            }
+
+            m_segments.push_back({phdrs[i].p_paddr - first, phdrs[i].p_offset, phdrs[i].p_filesz});
+        }
+
+        this->build_index(ef);
+    }
+
+    ~lazy_image()
+    {
+        if (m_thread.joinable()) {
+            uint64_t stop = 1;
+            if (write(m_stop, &stop, sizeof(stop)) == sizeof(stop)) {
+                m_thread.join();
+            }
+        }
+
+        if (m_uffd >= 0) {
+            close(m_uffd);
+        }
+
+        if (m_stop >= 0) {
+            close(m_stop);
+        }
+    }
+
+    void
+    start()
+    {
+        m_uffd = static_cast<int>(syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK));
+        if (m_uffd < 0) {
+            throw std::runtime_error("userfaultfd failed (see vm.unprivileged_userfaultfd)");
+        }
+
+        uffdio_api api = {};
+        api.api = UFFD_API;
+
+        if (ioctl(m_uffd, UFFDIO_API, &api) != 0) {
+            throw std::runtime_error("UFFDIO_API failed");
+        }
+
+        uffdio_register reg = {};
+        reg.range.start = reinterpret_cast<uint64_t>(m_exec);
+        reg.range.len = BFALIGN(m_size, BFELF_PAGE_SIZE);
+        reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+
+        if (ioctl(m_uffd, UFFDIO_REGISTER, &reg) != 0) {
+            throw std::runtime_error("UFFDIO_REGISTER failed");
+        }
+
+        m_stop = eventfd(0, EFD_CLOEXEC);
+        if (m_stop < 0) {
+            throw std::runtime_error("eventfd failed");
+        }
+
+        m_thread = std::thread(&lazy_image::handler, this);
+    }
+
+    uint64_t
+    pages_loaded() const noexcept
+    { return m_pages_loaded; }
+
+    uint64_t
+    pages_total() const noexcept
+    { return BFALIGN(m_size, BFELF_PAGE_SIZE) / BFELF_PAGE_SIZE; }
+
+    uint64_t
+    relocations() const noexcept
+    { return m_relocs.size(); }
+
+private:
+
+    // Copies [offset, offset + size) of the image into "buf" from the ELF
+    // file. Anything that is not part of the file portion of a segment
+    // (i.e., the BSS, and the gaps between segments) is zero.
+
+    void
+    read(bfelf64_addr offset, uint8_t *buf, bfelf64_xword size) const
+    {
+        std::memset(buf, 0, size);
+
+        for (const auto &segment : m_segments) {
+            auto begin = std::max(offset, segment.offset);
+            auto end = std::min(offset + size, segment.offset + segment.filesz);
+
+            if (begin < end) {
+                std::memcpy(buf + (begin - offset), m_file + segment.file_offset + (begin - segment.offset), end - begin);
+            }
+        }
+    }
+
+    void
+    build_index(const struct bfelf_file_t &ef)
+    {
+        std::vector<bfelf64_addr> offsets;
+
+        auto rela = std::vector<bfelf_rela>(ef.rela_array_size / sizeof(bfelf_rela));
+        this->read(ef.rela_array_addr, reinterpret_cast<uint8_t *>(rela.data()), rela.size() * sizeof(bfelf_rela));
+
+        for (const auto &entry : rela) {
+            if (BFELF_REL_TYPE(entry.r_info) != BFR_X86_64_RELATIVE) {
+                throw std::runtime_error("unsupported relocation type");
+            }
+
+            offsets.push_back(entry.r_offset);
+        }
+
+        auto relr = std::vector<bfelf_relr>(ef.relr_array_size / sizeof(bfelf_relr));
+        this->read(ef.relr_array_addr, reinterpret_cast<uint8_t *>(relr.data()), relr.size() * sizeof(bfelf_relr));
+
+        bfelf64_addr where = 0;
+        for (auto entry : relr) {
+            if ((entry & 1) == 0) {
+                offsets.push_back(entry);
+                where = entry + sizeof(bfelf64_addr);
+                continue;
+            }
+
+            for (auto addr = where; (entry >>= 1) != 0; addr += sizeof(bfelf64_addr)) {
+                if ((entry & 1) != 0) {
+                    offsets.push_back(addr);
+                }
+            }
+
+            where += BFELF_RELR_BITS * sizeof(bfelf64_addr);
+        }
+
+        // The index is a counting sort of the relocations by page: the
+        // relocations of page "p" are m_relocs[m_pages[p], m_pages[p + 1]).
+
+        m_pages = std::vector<uint64_t>(this->pages_total() + 1);
+        m_relocs = std::vector<bfelf64_addr>(offsets.size());
+
+        for (auto offset : offsets) {
+            if (offset + sizeof(bfelf64_addr) > m_size ||
+                (offset & (BFELF_PAGE_SIZE - 1)) > BFELF_PAGE_SIZE - sizeof(bfelf64_addr)) {
+                throw std::runtime_error("relocation is outside of the image, or crosses a page");
+            }
+
+            m_pages.at((offset / BFELF_PAGE_SIZE) + 1)++;
+        }
+
+        for (auto i = 1ULL; i < m_pages.size(); i++) {
+            m_pages.at(i) += m_pages.at(i - 1);
+        }
+
+        auto next = m_pages;
+        for (auto offset : offsets) {
+            m_relocs.at(next.at(offset / BFELF_PAGE_SIZE)++) = offset;
+        }
+    }
+
+    void
+    load_page(bfelf64_addr page)
+    {
+        auto *buf = m_buf;
+        auto offset = page - reinterpret_cast<bfelf64_addr>(m_exec);
+
+        this->read(offset, buf, BFELF_PAGE_SIZE);
+
+        auto index = offset / BFELF_PAGE_SIZE;
+        for (auto i = m_pages.at(index); i < m_pages.at(index + 1); i++) {
+            bfelf64_addr value;
+            auto *where = buf + (m_relocs.at(i) - offset);
+
+            std::memcpy(&value, where, sizeof(value));
+            value += m_delta;
+            std::memcpy(where, &value, sizeof(value));
+        }
+
+        uffdio_copy copy = {};
+        copy.dst = page;
+        copy.src = reinterpret_cast<uint64_t>(buf);
+        copy.len = BFELF_PAGE_SIZE;
+
+        if (ioctl(m_uffd, UFFDIO_COPY, &copy) != 0) {
+            if (errno != EEXIST) {
+                fprintf(stderr, "bfexec_lazy: UFFDIO_COPY failed: %s\n", strerror(errno));
+                abort();
+            }
+        }
+
+        m_pages_loaded++;
+    }
+
+    void
+    handler()
+    {
+        pollfd fds[2] = {{m_uffd, POLLIN, 0}, {m_stop, POLLIN, 0}};
+
+        while (true) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return;
+            }
+
+            if ((fds[1].revents & POLLIN) != 0) {
+                return;
+            }
+
+            uffd_msg msg;
+            if (::read(m_uffd, &msg, sizeof(msg)) != sizeof(msg)) {
+                continue;
+            }
+
+            if (msg.event != UFFD_EVENT_PAGEFAULT) {
+                continue;
+            }
+
+            this->load_page(msg.arg.pagefault.address & ~static_cast<uint64_t>(BFELF_PAGE_SIZE - 1));
+        }
+    }
+
+private:
+
+    const uint8_t *m_file;
+    uint8_t *m_exec;
+    bfelf64_xword m_size;
+    bfelf64_addr m_delta;
+
+    std::vector<segment_t> m_segments;
+    std::vector<uint64_t> m_pages;
+    std::vector<bfelf64_addr> m_relocs;
+
+    alignas(BFELF_PAGE_SIZE) uint8_t m_buf[BFELF_PAGE_SIZE];
+
+    int m_uffd{-1};
+    int m_stop{-1};
+    std::thread m_thread;
+    std::atomic<uint64_t> m_pages_loaded{};
+};
+
+// -----------------------------------------------------------------------------
+// Implementation
+// -----------------------------------------------------------------------------
+
+// Runs the provided application, loading (and relocating) each page of it
+// the first time it is touched, and reports how much of the image was
+// actually loaded, and how long it took to prepare the image.
+
+int main(int argc, const char *argv[])
+{
+    struct bfelf_file_t ef;
+
+    if (argc != 2) {
+        throw std::runtime_error("wrong number of arguments");
+    }
+
+    auto fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("failed to open input file");
+    }
+
+    auto size = static_cast<size_t>(lseek(fd, 0, SEEK_END));
+    auto file = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file == MAP_FAILED) {
+        throw std::runtime_error("failed to map input file");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (bfelf_file_init(file, &ef) != BFSUCCESS) {
+        throw std::runtime_error("bfelf_file_init failed");
+    }
+
+    auto exec = platform_alloc(ef.size);
+    if (exec == nullptr) {
+        throw std::runtime_error("failed to allocate memory for exec");
+    }
+
+    ef.exec_lazy = 1;
+
+    if (bfelf_file_load(&ef, exec, platform_mark_rx) != BFSUCCESS) {
+        throw std::runtime_error("bfelf_file_load failed");
+    }
+
+    auto image = std::make_unique<lazy_image>(static_cast<const uint8_t *>(file), ef);
+
+    if (bfelf_file_relocate(&ef, 0) != BFSUCCESS) {
+        throw std::runtime_error("bfelf_file_relocate failed");
+    }
+
+    image->start();
+
+    auto end = std::chrono::steady_clock::now();
+
+    struct _start_args_t args = {};
+    args.argc = 1;
+    args.argv = argv + 1;
+    args.exec = exec;
+    args.alloc = platform_alloc;
+    args.free = platform_free;
+    args.syscall = platform_syscall;
+    args.set_thread_pointer = platform_set_thread_pointer;
+    args.get_thread_pointer = platform_get_thread_pointer;
+
+    auto ret = bfexecs(&ef, &args);
+
+    fprintf(stderr, "prepare:        %10.3f ms\n", std::chrono::duration<double, std::milli>(end - start).count());
+    fprintf(stderr, "relocations:    %10llu\n", static_cast<unsigned long long>(image->relocations()));
+    fprintf(stderr, "pages loaded:   %10llu of %llu\n",
+        static_cast<unsigned long long>(image->pages_loaded()),
+        static_cast<unsigned long long>(image->pages_total()));
+
+    image.reset();
+    platform_free(exec, ef.size);
+    munmap(file, size);
+    close(fd);
+
+    return static_cast<int>(ret);
+}
@@ -0,0 +1,257 @@
+//
+// Copyright (C) 2019 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <asm/prctl.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <stdexcept>
+
+#include <bfexec.h>
+
+// -----------------------------------------------------------------------------
+// bfexec "funcs"
+// -----------------------------------------------------------------------------
+
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+
+int g_fd = -1;
+bool g_quiet = false;
+
+void *
+platform_alloc(size_t size)
+{
+    auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return nullptr;
+    }
+
+    return ptr;
+}
+
+void
+platform_free(void *ptr, size_t size)
+{ munmap(ptr, size); }
+
+status_t
+platform_mark_rx(void *addr, size_t size)
+{
+    if (mprotect(addr, size, PROT_READ|PROT_EXEC) != 0) {
+        return BFFAILURE;
+    }
+
+    return BFSUCCESS;
+}
+
+status_t
+platform_map_file(void *addr, bfelf64_off offset, bfelf64_xword size)
+{
+    auto ptr = mmap(
+        addr, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_FIXED, g_fd, static_cast<off_t>(offset));
+
+    if (ptr == MAP_FAILED) {
+        return BFFAILURE;
+    }
+
+    return BFSUCCESS;
+}
+
+void
+platform_syscall_write(bfsyscall_write_args *args)
+{
+    switch(args->fd) {
+        case STDOUT_FILENO:
+        case STDERR_FILENO:
+            if (g_quiet) {
+                args->ret = static_cast<decltype(args->ret)>(args->nbyte);
+                return;
+            }
+
+            errno = 0;
+            args->ret = write(args->fd, args->buf, args->nbyte);
+            args->error = errno;
+            return;
+
+        default:
+            return;
+    }
+}
+
+void
+platform_syscall(uint64_t id, void *args)
+{
+    switch(id) {
+        case BFSYSCALL_WRITE:
+            return platform_syscall_write(
+                static_cast<bfsyscall_write_args *>(args));
+
+        default:
+            return;
+    }
+}
+
+// Only used if BFTHREAD_CONTEXT_GS is defined. arch_prctl is used instead
+// of rdgsbase/wrgsbase as it works even if the kernel does not enable
+// FSGSBASE.
+
+void
+platform_set_thread_pointer(uint64_t ptr)
+{
+    if (syscall(SYS_arch_prctl, ARCH_SET_GS, ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+}
+
+uint64_t
+platform_get_thread_pointer()
+{
+    uint64_t ptr = 0;
+
+    if (syscall(SYS_arch_prctl, ARCH_GET_GS, &ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+
+    return ptr;
+}
+
+bfexec_funcs_t funcs = {
+    .alloc = platform_alloc,
+    .free = platform_free,
+    .mark_rx = platform_mark_rx,
+    .syscall = platform_syscall,
+    .alloc_zeroed = 1,
+    .map_file = platform_map_file,
+    .set_thread_pointer = platform_set_thread_pointer,
+    .get_thread_pointer = platform_get_thread_pointer
+};
+
+// -----------------------------------------------------------------------------
+// Implementation
+// -----------------------------------------------------------------------------
+
+// Runs the provided application once with output, and then the requested
+// number of times (default 1000) without output, using bfexecv(), using a
+// single bfexec_prepare() followed by bfexec_run(), and using an image that
+// is resumed with its heap reset (see bfexec_funcs_t::heap_reset), and
+// reports the average time of each invocation.
+
+template<typename F>
+double
+time(F func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+int main(int argc, const char *argv[])
+{
+    int iterations = 1000;
+
+    if (argc != 2 && argc != 3) {
+        throw std::runtime_error("wrong number of arguments");
+    }
+
+    if (argc == 3) {
+        iterations = atoi(argv[2]);
+    }
+
+    g_fd = open(argv[1], O_RDONLY);
+    if (g_fd < 0) {
+        throw std::runtime_error("failed to open input file");
+    }
+
+    auto size = static_cast<size_t>(lseek(g_fd, 0, SEEK_END));
+    auto file = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, g_fd, 0);
+    if (file == MAP_FAILED) {
+        throw std::runtime_error("failed to map input file");
+    }
+
+    const char *bfargv[] = {
+        argv[1], " Fork: https://github.com/Bareflank/standalone_cxx"
+    };
+
+    auto image = bfexec_prepare(file, &funcs);
+    if (image == nullptr) {
+        throw std::runtime_error("bfexec_prepare failed");
+    }
+
+    if (bfexec_run(image, 2, bfargv) != BFSUCCESS) {
+        throw std::runtime_error("bfexec_run failed");
+    }
+
+    auto reset_funcs = funcs;
+    reset_funcs.heap_reset = 1;
+
+    auto reset_image = bfexec_prepare(file, &reset_funcs);
+    if (reset_image == nullptr) {
+        throw std::runtime_error("bfexec_prepare failed");
+    }
+
+    if (bfexec_run(reset_image, 2, bfargv) != BFSUCCESS) {
+        throw std::runtime_error("bfexec_run failed");
+    }
+
+    g_quiet = true;
+
+    auto bfexecv_time = time([&] {
+        for (auto i = 0; i < iterations; i++) {
+            if (bfexecv(file, 2, bfargv, &funcs) != BFSUCCESS) {
+                throw std::runtime_error("bfexecv failed");
+            }
+        }
+    });
+
+    auto bfexec_run_time = time([&] {
+        for (auto i = 0; i < iterations; i++) {
+            if (bfexec_run(image, 2, bfargv) != BFSUCCESS) {
+                throw std::runtime_error("bfexec_run failed");
+            }
+        }
+    });
+
+    auto heap_reset_time = time([&] {
+        for (auto i = 0; i < iterations; i++) {
+            if (bfexec_run(reset_image, 2, bfargv) != BFSUCCESS) {
+                throw std::runtime_error("bfexec_run failed");
+            }
+        }
+    });
+
+    printf("bfexecv:    %10.2f us per run\n", bfexecv_time / iterations);
+    printf("bfexec_run: %10.2f us per run\n", bfexec_run_time / iterations);
+    printf("heap_reset: %10.2f us per run\n", heap_reset_time / iterations);
+
+    bfexec_release(reset_image);
+    bfexec_release(image);
+    munmap(file, size);
+    close(g_fd);
+
+    return 0;
+}
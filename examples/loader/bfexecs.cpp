@@ -21,6 +21,10 @@
 
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <asm/prctl.h>
+
+#include <stdexcept>
 
 #define BFINCLUDE_ALLOCATIONS
 #include <bfexec.h>
@@ -38,6 +42,7 @@ extern struct bfelf_file_t *ef;
 // -----------------------------------------------------------------------------
 
 #include <cerrno>
+#include <cstdio>
 #include <cstdlib>
 #include <unistd.h>
 
@@ -70,20 +75,55 @@ platform_syscall(uint64_t id, void *args)
     }
 }
 
+// Only used if BFTHREAD_CONTEXT_GS is defined. arch_prctl is used instead
+// of rdgsbase/wrgsbase as it works even if the kernel does not enable
+// FSGSBASE.
+
+void
+platform_set_thread_pointer(uint64_t ptr)
+{
+    if (syscall(SYS_arch_prctl, ARCH_SET_GS, ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+}
+
+uint64_t
+platform_get_thread_pointer()
+{
+    uint64_t ptr = 0;
+
+    if (syscall(SYS_arch_prctl, ARCH_GET_GS, &ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+
+    return ptr;
+}
+
 // -----------------------------------------------------------------------------
 // Implementation
 // -----------------------------------------------------------------------------
 
 int main(int argc, const char *argv[])
 {
+    struct heap_stats_t stats = {};
+
     struct _start_args_t args = {
         .exec = file,
-        .syscall = platform_syscall
+        .syscall = platform_syscall,
+        .set_thread_pointer = platform_set_thread_pointer,
+        .get_thread_pointer = platform_get_thread_pointer,
+        .heap_stats = &stats
     };
 
     if (mprotect(file, file_size, PROT_READ|PROT_WRITE|PROT_EXEC) != 0) {
         return BFFAILURE;
     }
 
-    return bfexecs(ef, &args);
+    auto ret = bfexecs(ef, &args);
+
+    printf("heap: %llu bytes peak, %llu bytes used by the heap at its peak\n",
+        static_cast<unsigned long long>(stats.peak_bytes),
+        static_cast<unsigned long long>(stats.peak_heap_bytes));
+
+    return ret;
 }
@@ -23,6 +23,10 @@
 
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <asm/prctl.h>
+
+#include <stdexcept>
 
 #include <bfexec.h>
 
@@ -71,6 +75,30 @@ platform_syscall(uint64_t id, void *args)
     }
 }
 
+// Only used if BFTHREAD_CONTEXT_GS is defined. arch_prctl is used instead
+// of rdgsbase/wrgsbase as it works even if the kernel does not enable
+// FSGSBASE.
+
+void
+platform_set_thread_pointer(uint64_t ptr)
+{
+    if (syscall(SYS_arch_prctl, ARCH_SET_GS, ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+}
+
+uint64_t
+platform_get_thread_pointer()
+{
+    uint64_t ptr = 0;
+
+    if (syscall(SYS_arch_prctl, ARCH_GET_GS, &ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+
+    return ptr;
+}
+
 // -----------------------------------------------------------------------------
 // Implementation
 // -----------------------------------------------------------------------------
@@ -80,7 +108,9 @@ int main(int argc, const char *argv[])
     struct _start_args_t args = {
         .exec = file,
         .alloc = malloc,
-        .syscall = platform_syscall
+        .syscall = platform_syscall,
+        .set_thread_pointer = platform_set_thread_pointer,
+        .get_thread_pointer = platform_get_thread_pointer
     };
 
     if (mprotect(file, file_size, PROT_READ|PROT_WRITE|PROT_EXEC) != 0) {
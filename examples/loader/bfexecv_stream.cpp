@@ -0,0 +1,172 @@
+//
+// Copyright (C) 2019 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <asm/prctl.h>
+
+#include <fcntl.h>
+#include <stdexcept>
+
+#include <bfexec.h>
+
+// -----------------------------------------------------------------------------
+// bfexec "funcs"
+// -----------------------------------------------------------------------------
+
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+
+void *
+platform_alloc(size_t size)
+{ return aligned_alloc(0x20000, size); }
+
+void
+platform_free(void *ptr, size_t size)
+{ bfignored(size); return free(ptr); }
+
+status_t
+platform_mark_rx(void *addr, size_t size)
+{
+    if (mprotect(addr, size, PROT_READ|PROT_EXEC) != 0) {
+        return BFFAILURE;
+    }
+
+    return BFSUCCESS;
+}
+
+void
+platform_syscall_write(bfsyscall_write_args *args)
+{
+    switch(args->fd) {
+        case STDOUT_FILENO:
+        case STDERR_FILENO:
+            errno = 0;
+            args->ret = write(args->fd, args->buf, args->nbyte);
+            args->error = errno;
+            return;
+
+        default:
+            return;
+    }
+}
+
+void
+platform_syscall(uint64_t id, void *args)
+{
+    switch(id) {
+        case BFSYSCALL_WRITE:
+            return platform_syscall_write(
+                static_cast<bfsyscall_write_args *>(args));
+
+        default:
+            return;
+    }
+}
+
+// Only used if BFTHREAD_CONTEXT_GS is defined. arch_prctl is used instead
+// of rdgsbase/wrgsbase as it works even if the kernel does not enable
+// FSGSBASE.
+
+void
+platform_set_thread_pointer(uint64_t ptr)
+{
+    if (syscall(SYS_arch_prctl, ARCH_SET_GS, ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+}
+
+uint64_t
+platform_get_thread_pointer()
+{
+    uint64_t ptr = 0;
+
+    if (syscall(SYS_arch_prctl, ARCH_GET_GS, &ptr) != 0) {
+        throw std::runtime_error("arch_prctl failed");
+    }
+
+    return ptr;
+}
+
+bfexec_funcs_t funcs = {
+    .alloc = platform_alloc,
+    .free = platform_free,
+    .mark_rx = platform_mark_rx,
+    .syscall = platform_syscall,
+    .set_thread_pointer = platform_set_thread_pointer,
+    .get_thread_pointer = platform_get_thread_pointer
+};
+
+// -----------------------------------------------------------------------------
+// ELF file reader
+// -----------------------------------------------------------------------------
+
+int g_fd = -1;
+
+status_t
+platform_read(bfelf64_off offset, void *buf, bfelf64_xword size)
+{
+    auto *ptr = static_cast<char *>(buf);
+
+    while (size > 0) {
+        auto ret = pread(g_fd, ptr, size, static_cast<off_t>(offset));
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+
+            return BFFAILURE;
+        }
+
+        ptr += ret;
+        size -= static_cast<bfelf64_xword>(ret);
+        offset += static_cast<bfelf64_off>(ret);
+    }
+
+    return BFSUCCESS;
+}
+
+// -----------------------------------------------------------------------------
+// Implementation
+// -----------------------------------------------------------------------------
+
+int main(int argc, const char *argv[])
+{
+    if (argc != 2) {
+        throw std::runtime_error("wrong number of arguments");
+    }
+
+    g_fd = open(argv[1], O_RDONLY);
+    if (g_fd < 0) {
+        throw std::runtime_error("failed to open input file");
+    }
+
+    const char *bfargv[] = {
+        argv[1], " Fork: https://github.com/Bareflank/standalone_cxx"
+    };
+
+    auto ret = bfexecv_stream(platform_read, 2, bfargv, &funcs);
+
+    close(g_fd);
+    return static_cast<int>(ret);
+}
@@ -0,0 +1,167 @@
+//
+// Copyright (C) 2019 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <bfelf_loader.h>
+
+// -----------------------------------------------------------------------------
+// Thread Pool
+// -----------------------------------------------------------------------------
+
+// A minimal thread pool that implements bfexec_funcs_t::parallel_for. The
+// workers are started once and then wait for work, so that handing a job to
+// the pool only costs a wake up. The calling thread works on the job too, so
+// a pool of "num" threads has num - 1 workers, and a pool of 1 thread runs
+// everything on the calling thread. Only one thread may call run() at a time.
+
+class thread_pool
+{
+public:
+
+    using func_t = void (*)(void *, bfelf64_xword);
+
+    explicit thread_pool(size_t num = std::thread::hardware_concurrency())
+    {
+        for (size_t i = 1; i < num; i++) {
+            m_workers.emplace_back(&thread_pool::worker, this);
+        }
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+
+        m_work.notify_all();
+
+        for (auto &worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    void
+    run(func_t func, void *ctx, bfelf64_xword num)
+    {
+        if (m_workers.empty() || num <= 1) {
+            for (bfelf64_xword i = 0; i < num; i++) {
+                func(ctx, i);
+            }
+
+            return;
+        }
+
+        {
+            std::lock_guard lock(m_mutex);
+
+            m_func = func;
+            m_ctx = ctx;
+            m_num = num;
+            m_next = 0;
+            m_busy = m_workers.size();
+            m_generation++;
+        }
+
+        m_work.notify_all();
+        this->work(func, ctx, num);
+
+        std::unique_lock lock(m_mutex);
+        m_idle.wait(lock, [&] { return m_busy == 0; });
+    }
+
+    size_t
+    size() const noexcept
+    { return m_workers.size() + 1; }
+
+private:
+
+    void
+    work(func_t func, void *ctx, bfelf64_xword num)
+    {
+        for (auto i = m_next++; i < num; i = m_next++) {
+            func(ctx, i);
+        }
+    }
+
+    void
+    worker()
+    {
+        uint64_t generation = 0;
+
+        while (true) {
+            func_t func;
+            void *ctx;
+            bfelf64_xword num;
+
+            {
+                std::unique_lock lock(m_mutex);
+                m_work.wait(lock, [&] { return m_stop || m_generation != generation; });
+
+                if (m_stop) {
+                    return;
+                }
+
+                generation = m_generation;
+
+                func = m_func;
+                ctx = m_ctx;
+                num = m_num;
+            }
+
+            this->work(func, ctx, num);
+
+            {
+                std::lock_guard lock(m_mutex);
+                if (--m_busy == 0) {
+                    m_idle.notify_one();
+                }
+            }
+        }
+    }
+
+private:
+
+    std::mutex m_mutex;
+    std::condition_variable m_work;
+    std::condition_variable m_idle;
+
+    func_t m_func{};
+    void *m_ctx{};
+    bfelf64_xword m_num{};
+    std::atomic<bfelf64_xword> m_next{};
+
+    size_t m_busy{};
+    uint64_t m_generation{};
+    bool m_stop{};
+
+    std::vector<std::thread> m_workers;
+};
+
+#endif
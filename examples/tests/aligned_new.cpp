@@ -0,0 +1,99 @@
+//
+// Copyright (C) 2019 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <initializer_list>
+#include <memory>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Allocates memory aligned to 64 bytes, 4KB and 2MB using posix_memalign,
+// aligned_alloc and aligned new, and makes sure the memory is aligned and
+// can be written to.
+
+template<size_t A>
+struct alignas(A) aligned_t {
+    uint8_t data[A];
+};
+
+static bool
+check(const char *name, void *ptr, size_t alignment, size_t size)
+{
+    if (ptr == nullptr || reinterpret_cast<uintptr_t>(ptr) % alignment != 0) {
+        printf("%s: %zu byte alignment FAILED\n", name, alignment);
+        return false;
+    }
+
+    memset(ptr, 0xBF, size);
+    return true;
+}
+
+template<size_t A>
+static bool
+test()
+{
+    for (auto size : {size_t(1), A - 1, A, A + 1, 3 * A}) {
+        void *ptr1 = nullptr;
+
+        if (posix_memalign(&ptr1, A, size) != 0 || !check("posix_memalign", ptr1, A, size)) {
+            return false;
+        }
+
+        auto ptr2 = aligned_alloc(A, size);
+        if (!check("aligned_alloc", ptr2, A, size)) {
+            return false;
+        }
+
+        free(ptr1);
+        free(ptr2);
+    }
+
+    auto obj = std::make_unique<aligned_t<A>>();
+    if (!check("new", obj.get(), A, sizeof(*obj))) {
+        return false;
+    }
+
+    auto arr = std::make_unique<aligned_t<A>[]>(3);
+    if (!check("new[]", arr.get(), A, 3 * sizeof(arr[0]))) {
+        return false;
+    }
+
+    return true;
+}
+
+int main()
+{
+    void *ptr = nullptr;
+
+    if (posix_memalign(&ptr, 24, 1) != EINVAL) {
+        printf("posix_memalign: invalid alignment FAILED\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!test<64>() || !test<0x1000>() || !test<0x200000>()) {
+        return EXIT_FAILURE;
+    }
+
+    printf("aligned allocations passed\n");
+    return EXIT_SUCCESS;
+}
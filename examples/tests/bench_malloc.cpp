@@ -0,0 +1,107 @@
+//
+// Copyright (C) 2019 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <bfheapstats.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+
+// Measures the cost of malloc/free, std::string and std::map churn in TSC
+// ticks per operation. To compare the runtime's allocator with newlib's,
+// run this once with the default build and once with
+// BAREFLANK_NEWLIB_MALLOC=ON.
+
+constexpr auto num_ops = 200000ULL;
+constexpr auto num_live = 1024ULL;
+
+static uint64_t g_seed = 42;
+
+static uint64_t
+rand64()
+{
+    g_seed = g_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return g_seed >> 33;
+}
+
+template<typename F>
+void
+bench(const char *name, F func)
+{
+    auto start = __builtin_ia32_rdtsc();
+    func();
+    auto end = __builtin_ia32_rdtsc();
+
+    printf("%-8s %8llu ticks/op\n", name, static_cast<unsigned long long>((end - start) / num_ops));
+}
+
+int main()
+{
+    bench("malloc", [] {
+        std::vector<void *> live(num_live);
+
+        for (auto i = 0ULL; i < num_ops; i++) {
+            auto &ptr = live[rand64() % num_live];
+
+            free(ptr);
+            ptr = malloc(16 + (rand64() % 512));
+        }
+
+        for (auto ptr : live) {
+            free(ptr);
+        }
+    });
+
+    bench("string", [] {
+        std::vector<std::string> live(num_live);
+
+        for (auto i = 0ULL; i < num_ops; i++) {
+            live[rand64() % num_live] = std::string(24 + (rand64() % 256), 'x');
+        }
+    });
+
+    bench("map", [] {
+        std::map<uint64_t, std::string> live;
+
+        for (auto i = 0ULL; i < num_ops; i++) {
+            auto key = rand64() % (num_live * 2);
+
+            if (auto iter = live.find(key); iter != live.end()) {
+                live.erase(iter);
+            }
+            else {
+                live.emplace(key, std::string(24 + (rand64() % 64), 'x'));
+            }
+        }
+    });
+
+    struct heap_stats_t stats = {};
+    bfheap_stats(&stats);
+
+    printf("peak: %llu bytes allocated, %llu bytes of heap\n",
+        static_cast<unsigned long long>(stats.peak_bytes),
+        static_cast<unsigned long long>(stats.peak_heap_bytes));
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+//
+// Copyright (C) 2019 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <bfheap.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <cstdio>
+#include <cstdlib>
+
+// Fills a vector using an arena, releases the arena and makes sure that
+// the memory is reused by the next arena, and that memory allocated before
+// or while the arena exists is not touched by either of them. Memory that
+// was allocated before the arena must still be reused once it is freed, and
+// an arena that is nested in another arena must only free its own memory.
+
+static bool
+fill(bfheap_arena &arena, void **first)
+{
+    std::vector<uint64_t, bfpmr::polymorphic_allocator<uint64_t>> values(&arena);
+
+    for (auto i = 0ULL; i < 100000; i++) {
+        values.push_back(i);
+    }
+
+    for (auto i = 0ULL; i < values.size(); i++) {
+        if (values.at(i) != i) {
+            return false;
+        }
+    }
+
+    *first = arena.allocate(64);
+    return true;
+}
+
+int main()
+{
+    std::string before(1000, 'x');
+    std::string during;
+    void *first1 = nullptr;
+    void *first2 = nullptr;
+
+    {
+        bfheap_arena arena;
+        if (!fill(arena, &first1)) {
+            printf("heap arena FAILED\n");
+            return EXIT_FAILURE;
+        }
+
+        during.assign(1000, 'y');
+    }
+
+    {
+        bfheap_arena arena;
+        if (!fill(arena, &first2)) {
+            printf("heap arena FAILED\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (first1 != first2 || before != std::string(1000, 'x') || during != std::string(1000, 'y')) {
+        printf("heap arena reset FAILED\n");
+        return EXIT_FAILURE;
+    }
+
+    auto block = malloc(100);
+    {
+        bfheap_arena arena;
+        if (!fill(arena, &first1)) {
+            printf("heap arena FAILED\n");
+            return EXIT_FAILURE;
+        }
+
+        arena.release();
+    }
+
+    free(block);
+
+    auto again = malloc(100);
+    free(again);
+
+    if (again != block) {
+        printf("heap arena free FAILED\n");
+        return EXIT_FAILURE;
+    }
+
+    {
+        bfheap_arena outer;
+
+        auto marker = static_cast<char *>(outer.allocate(1000));
+        std::fill(marker, marker + 1000, 'z');
+
+        for (auto i = 0; i < 2; i++) {
+            bfheap_arena inner(&outer);
+            if (inner.upstream_resource() != &outer || !fill(inner, &first1)) {
+                printf("heap arena nested FAILED\n");
+                return EXIT_FAILURE;
+            }
+        }
+
+        if (std::count(marker, marker + 1000, 'z') != 1000) {
+            printf("heap arena nested reset FAILED\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("heap arena passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,59 @@
+//
+// Copyright (C) 2019 Assured Information Security, Inc.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <memory>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Allocates four times the size of the heap given to _start, so that the
+// heap has to grow using the loader's alloc function, and makes sure the
+// memory can be written to and freed.
+
+constexpr auto block_size = 0x10000ULL;
+constexpr auto num_blocks = (4ULL * BFHEAP_SIZE) / block_size;
+
+int main()
+{
+    std::vector<std::unique_ptr<uint8_t[]>> blocks;
+
+    for (auto i = 0ULL; i < num_blocks; i++) {
+        auto block = std::make_unique<uint8_t[]>(block_size);
+        memset(block.get(), static_cast<int>(i), block_size);
+
+        blocks.push_back(std::move(block));
+    }
+
+    for (auto i = 0ULL; i < num_blocks; i++) {
+        if (blocks.at(i)[block_size - 1] != static_cast<uint8_t>(i)) {
+            printf("heap grow FAILED\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    blocks.clear();
+
+    printf("heap grow passed\n");
+    return EXIT_SUCCESS;
+}
@@ -24,6 +24,7 @@
 #include <efilib.h>
 
 #define BFALERT(...) Print(L"[BAREFLANK ALERT]: " __VA_ARGS__)
+#define BFSINGLE_ALLOCATION
 #include <bfexec.h>
 
 /* -------------------------------------------------------------------------- */
@@ -97,6 +98,32 @@ platform_syscall(uint64_t id, void *args)
     }
 }
 
+/*
+ * Only used if BFTHREAD_CONTEXT_GS is defined. UEFI apps run in ring 0, so
+ * the GS base is read and written using the IA32_GS_BASE MSR, which works
+ * even if the CPU does not support FSGSBASE.
+ */
+
+#define IA32_GS_BASE 0xC0000101
+
+void
+platform_set_thread_pointer(uint64_t ptr)
+{
+    __asm__ volatile(
+        "wrmsr" ::
+        "c"(IA32_GS_BASE), "a"((uint32_t)ptr), "d"((uint32_t)(ptr >> 32)) : "memory");
+}
+
+uint64_t
+platform_get_thread_pointer(void)
+{
+    uint32_t lo;
+    uint32_t hi;
+
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(IA32_GS_BASE));
+    return ((uint64_t)hi << 32) | lo;
+}
+
 /* -------------------------------------------------------------------------- */
 /* Implementation                                                             */
 /* -------------------------------------------------------------------------- */
@@ -115,11 +142,14 @@ efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *systab)
      * block, stack and heap are still needed, and we do not want to statically
      * allocate this in the app like we do with the other loader example as the
      * UEFI app would place this into the app (not BSS) which would make it
-     * huge.
+     * huge. Since BFSINGLE_ALLOCATION is defined, all three are allocated
+     * using a single call to AllocatePages.
      */
     struct _start_args_t args = {
         .alloc = platform_alloc,
-        .syscall = platform_syscall
+        .syscall = platform_syscall,
+        .set_thread_pointer = platform_set_thread_pointer,
+        .get_thread_pointer = platform_get_thread_pointer
     };
 
     /*